@@ -120,6 +120,7 @@ static void fm_config_init(FmConfig *self)
     self->show_thumbnail = FM_CONFIG_DEFAULT_SHOW_THUMBNAIL;
     self->thumbnail_local = FM_CONFIG_DEFAULT_THUMBNAIL_LOCAL;
     self->thumbnail_max = FM_CONFIG_DEFAULT_THUMBNAIL_MAX;
+    self->thumbnail_cache_size = FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_SIZE;
     /* show_internal_volumes defaulted to FALSE */
     /* si_unit defaulted to FALSE */
     /* terminal and archiver defaulted to NULL */
@@ -226,6 +227,7 @@ void fm_config_load_from_key_file(FmConfig* cfg, GKeyFile* kf)
     cfg->archiver = g_key_file_get_string(kf, "config", "archiver", NULL);
     fm_key_file_get_bool(kf, "config", "thumbnail_local", &cfg->thumbnail_local);
     fm_key_file_get_int(kf, "config", "thumbnail_max", &cfg->thumbnail_max);
+    fm_key_file_get_int(kf, "config", "thumbnail_cache_size", &cfg->thumbnail_cache_size);
     fm_key_file_get_bool(kf, "config", "advanced_mode", &cfg->advanced_mode);
     fm_key_file_get_bool(kf, "config", "si_unit", &cfg->si_unit);
     fm_key_file_get_bool(kf, "config", "force_startup_notify", &cfg->force_startup_notify);
@@ -424,6 +426,7 @@ void fm_config_save(FmConfig* cfg, const char* name)
                 _save_config_string(str, cfg, archiver);
                 _save_config_bool(str, cfg, thumbnail_local);
                 _save_config_int(str, cfg, thumbnail_max);
+                _save_config_int(str, cfg, thumbnail_cache_size);
                 _save_config_strv(str, cfg, modules_blacklist);
                 _save_config_strv(str, cfg, modules_whitelist);
             g_string_append(str, "\n[ui]\n");
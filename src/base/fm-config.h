@@ -55,6 +55,7 @@ typedef struct _FmConfigClass       FmConfigClass;
 #define     FM_CONFIG_DEFAULT_SHOW_THUMBNAIL    TRUE
 #define     FM_CONFIG_DEFAULT_THUMBNAIL_LOCAL   TRUE
 #define     FM_CONFIG_DEFAULT_THUMBNAIL_MAX     2048
+#define     FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_SIZE 32768
 
 #define     FM_CONFIG_DEFAULT_FORCE_S_NOTIFY    TRUE
 #define     FM_CONFIG_DEFAULT_BACKUP_HIDDEN     TRUE
@@ -107,6 +108,7 @@ typedef enum
  * @thumbnail_max: show thumbnails for files smaller than 'thumb_max' KB
  * @auto_selection_delay: (since 1.2.0) delay for autoselection in single-click mode, in ms
  * @drop_default_action: (since 1.2.0) default action on drop (see #FmDndDestDropAction)
+ * @thumbnail_cache_size: (since 1.2.0) memory kept for recently shown thumbnails, in KB
  * @single_click: single click to open file
  * @use_trash: delete file to trash can
  * @confirm_del: ask before deleting files
@@ -153,6 +155,7 @@ struct _FmConfig
     gint thumbnail_max;
     gint auto_selection_delay;
     gint drop_default_action;
+    gint thumbnail_cache_size;
 
     gboolean single_click;
     gboolean use_trash;
@@ -46,6 +46,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <signal.h>
 
 #ifdef USE_EXIF
@@ -60,6 +62,12 @@
 #endif
 
 #define THUMBNAILER_TIMEOUT_SEC     30
+/* max number of external thumbnailers running at once */
+#define THUMBNAILER_MAX_PROCESSES   4
+/* max number of threads loading and generating thumbnails at once */
+#define LOADER_MAX_THREADS          8
+/* initial buffer size for JPEG data read by libexif */
+#define EXIF_BUFFER_SIZE            65536
 
 static gboolean backend_loaded = FALSE;
 static FmThumbnailLoaderBackend backend = {NULL};
@@ -82,7 +90,11 @@ struct _ThumbnailTask
     char* uri;              /* used internally */
     char* normal_path;      /* used internally */
     char* large_path;       /* used internally */
+    GCancellable* cancellable; /* cancels generation when task is locked */
     GList* requests;        /* access should be locked */
+    GSequenceIter* iter;    /* position in loader_queue, NULL if not queued */
+    gint priority;          /* max priority of not cancelled requests */
+    guint64 serial;         /* order of queueing for tasks with same priority */
 };
 /* cancelled above raised when all requests are cancelled and never dropped again */
 
@@ -95,6 +107,7 @@ struct _FmThumbnailLoader
     gpointer user_data;
     GObject* pix;
     sig_atomic_t cancelled;
+    gint priority;
     gshort size;
     gboolean done : 1; /* it has pix set so will be pushed into ready queue */
 };
@@ -103,7 +116,9 @@ typedef struct _ThumbnailCacheItem ThumbnailCacheItem;
 struct _ThumbnailCacheItem
 {
     guint size;
-    GObject* pix; /* no reference on it */
+    GObject* pix; /* no reference on it unless it's in recent_thumbnails */
+    GList* recent; /* link in recent_thumbnails or NULL */
+    gsize bytes; /* memory used by pix */
 };
 
 typedef struct _ThumbnailCache ThumbnailCache;
@@ -113,8 +128,6 @@ struct _ThumbnailCache
     GSList* items;
 };
 
-/* FIXME: use thread pool */
-
 /* Lock for loader, generator, and ready queues */
 #if GLIB_CHECK_VERSION(2, 32, 0)
 static GRecMutex queue_lock;
@@ -125,12 +138,13 @@ static GStaticRecMutex queue_lock = G_STATIC_REC_MUTEX_INIT;
 #endif
 
 /* load generated thumbnails */
-static GQueue loader_queue = G_QUEUE_INIT; /* consists of ThumbnailTask */
-static GThread* loader_thread_id = NULL;
-static ThumbnailTask* cur_loading = NULL;
-
-/* generate thumbnails for files */
-static GCancellable* generator_cancellable = NULL;
+/* consists of ThumbnailTask sorted by priority, the first one is served first */
+static GSequence* loader_queue = NULL;
+static guint64 loader_queue_serial = 0;
+/* each task in loader_queue has own item pushed into the pool, the thread
+   which receives it takes the first task from loader_queue */
+static GThreadPool* loader_pool = NULL;
+static GSList* loading = NULL; /* tasks being processed by loader_pool */
 
 /* already loaded thumbnails */
 static GQueue ready_queue = G_QUEUE_INIT; /* consists of FmThumbnailLoader */
@@ -139,17 +153,38 @@ static guint ready_idle_handler = 0;
 
 /* cached thumbnails, elements are ThumbnailCache* */
 static GHashTable* hash = NULL;
+/* recently used thumbnails, the most recent first; these are referenced
+   so stay in memory until pushed out by fm_config->thumbnail_cache_size */
+static GQueue recent_thumbnails = G_QUEUE_INIT; /* consists of ThumbnailCacheItem */
+static gsize recent_thumbnails_size = 0;
 
 static char* thumb_dir = NULL;
 
-static GPid thumbnailer_pid = -1; /* for cur_loading task */
-static guint thumbnailer_timeout_id = 0;
+/* running external thumbnailers, access should be locked */
+typedef struct
+{
+    GPid pid; /* -1 if it was killed */
+    ThumbnailTask* task;
+    guint timeout_id;
+} ThumbnailerProcess;
+static GSList* thumbnailers = NULL;
+
+/* number of thumbnailers which still can be started */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+static GMutex thumbnailer_slots_mutex;
+static GCond thumbnailer_slots_cond;
+#else
+static GMutex *thumbnailer_slots_mutex = NULL;
+static GCond *thumbnailer_slots_cond = NULL;
+#endif
+static guint thumbnailer_slots = 0;
 
-static gpointer load_thumbnail_thread(gpointer user_data);
+static void load_thumbnail_task(gpointer data, gpointer unused);
 static void load_thumbnails(ThumbnailTask* task);
 static void generate_thumbnails(ThumbnailTask* task);
 static void generate_thumbnails_with_builtin(ThumbnailTask* task);
 static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task);
+static void thumbnailer_slots_add(guint delta);
 static GObject* scale_pix(GObject* ori_pix, int size);
 static void save_thumbnail_to_disk(ThumbnailTask* task, GObject* pix, const char* path);
 
@@ -202,6 +237,7 @@ inline static void thumbnail_task_free(ThumbnailTask* task)
     if(task->requests)
         g_list_free(task->requests);
     fm_file_info_unref(task->fi);
+    g_object_unref(task->cancellable);
     g_slice_free(ThumbnailTask, task);
 }
 
@@ -239,6 +275,45 @@ static void on_pixbuf_destroy(gpointer data, GObject* obj_ptr)
     g_rec_mutex_unlock(&queue_lock);
 }
 
+/* called with queue lock held */
+/* drops least recently used thumbnails until they fit into budget */
+static void recent_thumbnails_trim(gsize budget)
+{
+    while(recent_thumbnails_size > budget)
+    {
+        GList* link = g_queue_pop_tail_link(&recent_thumbnails);
+        ThumbnailCacheItem* item = (ThumbnailCacheItem*)link->data;
+
+        g_list_free_1(link);
+        item->recent = NULL;
+        recent_thumbnails_size -= item->bytes;
+        /* if nobody else uses it then item will be freed by on_pixbuf_destroy() */
+        g_object_unref(item->pix);
+    }
+}
+
+/* called with queue lock held */
+/* marks item as the most recently used one */
+static void cache_item_touch(ThumbnailCacheItem* item)
+{
+    gsize budget = (gsize)MAX(fm_config->thumbnail_cache_size, 0) << 10;
+
+    if(item->recent)
+    {
+        g_queue_unlink(&recent_thumbnails, item->recent);
+        g_queue_push_head_link(&recent_thumbnails, item->recent);
+    }
+    else if(item->bytes <= budget)
+    {
+        item->recent = g_list_alloc();
+        item->recent->data = item;
+        g_queue_push_head_link(&recent_thumbnails, item->recent);
+        recent_thumbnails_size += item->bytes;
+        g_object_ref(item->pix);
+    }
+    recent_thumbnails_trim(budget);
+}
+
 /* called with queue lock held */
 /* in thread */
 inline static void cache_thumbnail_in_hash(FmPath* path, GObject* pix, guint size)
@@ -267,9 +342,13 @@ inline static void cache_thumbnail_in_hash(FmPath* path, GObject* pix, guint siz
         item = g_slice_new(ThumbnailCacheItem);
         item->size = size;
         item->pix = pix;
+        item->recent = NULL;
+        /* decoded images are RGBA */
+        item->bytes = (gsize)backend.get_image_width(pix) * backend.get_image_height(pix) * 4;
         cache->items = g_slist_prepend(cache->items, item);
         g_object_weak_ref(G_OBJECT(pix), on_pixbuf_destroy, cache);
     }
+    cache_item_touch(item);
 }
 
 /* in thread */
@@ -334,6 +413,65 @@ push_it:
         g_object_unref(cached_pix);
 }
 
+typedef enum
+{
+    THUMBNAIL_UNKNOWN, /* no Thumb::MTime before image data */
+    THUMBNAIL_VALID,
+    THUMBNAIL_OUTDATED,
+    THUMBNAIL_MISSING
+} ThumbnailState;
+
+/* in thread */
+/* checks Thumb::URI and Thumb::MTime reading only headers of PNG chunks and
+   tEXt chunks before image data so outdated thumbnail is never decoded */
+static ThumbnailState check_thumbnail_file(const char* thumbnail_path,
+                                           const char* uri, time_t mtime)
+{
+    static const guchar png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    guchar header[8];
+    char text[1024];
+    ThumbnailState state = THUMBNAIL_UNKNOWN;
+    int fd = open(thumbnail_path, O_RDONLY);
+
+    if(fd < 0)
+        return THUMBNAIL_MISSING;
+    if(read(fd, header, 8) != 8 || memcmp(header, png_signature, 8) != 0)
+    {
+        close(fd);
+        return THUMBNAIL_UNKNOWN; /* let the backend handle it */
+    }
+    /* each chunk is: length (4 bytes, big endian), type (4 bytes), data, CRC */
+    while(state != THUMBNAIL_OUTDATED && read(fd, header, 8) == 8)
+    {
+        guint32 len = ((guint32)header[0] << 24) | ((guint32)header[1] << 16) |
+                      ((guint32)header[2] << 8) | header[3];
+        const char* value;
+
+        if(memcmp(header + 4, "IDAT", 4) == 0 || memcmp(header + 4, "IEND", 4) == 0)
+            break; /* image data started, no more text is expected */
+        /* the text is read together with CRC and terminated after that */
+        if(memcmp(header + 4, "tEXt", 4) != 0 || len > sizeof(text) - 5)
+        {
+            if(lseek(fd, (off_t)len + 4, SEEK_CUR) < 0)
+                break;
+            continue;
+        }
+        if(read(fd, text, len + 4) != (ssize_t)len + 4) /* with CRC */
+            break;
+        text[len] = '\0';
+        value = memchr(text, '\0', len); /* keyword is terminated by NUL */
+        if(!value)
+            continue;
+        value++;
+        if(strcmp(text, "Thumb::MTime") == 0)
+            state = (atol(value) == mtime) ? THUMBNAIL_VALID : THUMBNAIL_OUTDATED;
+        else if(strcmp(text, "Thumb::URI") == 0 && uri && strcmp(value, uri) != 0)
+            state = THUMBNAIL_OUTDATED; /* checksum collision */
+    }
+    close(fd);
+    return state;
+}
+
 /* in thread */
 static gboolean is_thumbnail_outdated(GObject* thumb_pix, const char* thumbnail_path, time_t mtime)
 {
@@ -366,6 +504,31 @@ static gboolean is_thumbnail_outdated(GObject* thumb_pix, const char* thumbnail_
     return outdated;
 }
 
+/* in thread */
+/* returns NULL if thumbnail should be generated */
+static GObject* load_thumbnail_file(const char* thumbnail_path, const char* uri, time_t mtime)
+{
+    GObject* pix;
+
+    switch(check_thumbnail_file(thumbnail_path, uri, mtime))
+    {
+    case THUMBNAIL_MISSING:
+        return NULL;
+    case THUMBNAIL_OUTDATED:
+        unlink(thumbnail_path); /* delete the out-dated thumbnail. */
+        return NULL;
+    case THUMBNAIL_VALID:
+        return backend.read_image_from_file(thumbnail_path);
+    case THUMBNAIL_UNKNOWN:
+    default:
+        pix = backend.read_image_from_file(thumbnail_path);
+        /* pix is freed in is_thumbnail_outdated() if it's out of date. */
+        if(!pix || is_thumbnail_outdated(pix, thumbnail_path, mtime))
+            return NULL;
+        return pix;
+    }
+}
+
 /* in thread */
 static void load_thumbnails(ThumbnailTask* task)
 {
@@ -381,13 +544,11 @@ static void load_thumbnails(ThumbnailTask* task)
 
     if(task->flags & LOAD_NORMAL)
     {
-        normal_pix = backend.read_image_from_file(normal_path);
-        if(!normal_pix || is_thumbnail_outdated(normal_pix, normal_path, fm_file_info_get_mtime(task->fi)))
+        normal_pix = load_thumbnail_file(normal_path, task->uri, fm_file_info_get_mtime(task->fi));
+        if(!normal_pix)
         {
-            /* normal_pix is freed in is_thumbnail_outdated() if it's out of date. */
             /* generate normal size thumbnail */
             task->flags |= GENERATE_NORMAL;
-            normal_pix = NULL;
             /* DEBUG("need to generate normal thumbnail"); */
         }
         else
@@ -401,13 +562,11 @@ static void load_thumbnails(ThumbnailTask* task)
 
     if(task->flags & LOAD_LARGE)
     {
-        large_pix = backend.read_image_from_file(large_path);
-        if(!large_pix || is_thumbnail_outdated(large_pix, large_path, fm_file_info_get_mtime(task->fi)))
+        large_pix = load_thumbnail_file(large_path, task->uri, fm_file_info_get_mtime(task->fi));
+        if(!large_pix)
         {
-            /* large_pix is freed in is_thumbnail_outdated() if it's out of date. */
             /* generate large size thumbnail */
             task->flags |= GENERATE_LARGE;
-            large_pix = NULL;
         }
     }
 
@@ -424,92 +583,110 @@ _out:
     return;
 }
 
-/* in thread */
-static gpointer load_thumbnail_thread(gpointer user_data)
+static gint compare_tasks(gconstpointer a, gconstpointer b, gpointer unused)
 {
-    ThumbnailTask* task;
-    GChecksum* sum = g_checksum_new(G_CHECKSUM_MD5);
-    gchar* normal_path  = g_build_filename(thumb_dir, "normal/00000000000000000000000000000000.png", NULL);
-    gchar* normal_basename = strrchr(normal_path, '/') + 1;
-    gchar* large_path = g_build_filename(thumb_dir, "large/00000000000000000000000000000000.png", NULL);
-    gchar* large_basename = strrchr(large_path, '/') + 1;
+    const ThumbnailTask* task_a = (const ThumbnailTask*)a;
+    const ThumbnailTask* task_b = (const ThumbnailTask*)b;
 
-    /* ensure thumbnail directories exists */
-    g_mkdir_with_parents(normal_path, 0700);
-    g_mkdir_with_parents(large_path, 0700);
+    if(task_a->priority != task_b->priority)
+        return (task_a->priority > task_b->priority) ? -1 : 1;
+    return (task_a->serial < task_b->serial) ? -1 : (task_a->serial > task_b->serial);
+}
 
-    for(;;)
-    {
-        g_rec_mutex_lock(&queue_lock);
-        task = g_queue_pop_head(&loader_queue);
-        cur_loading = task;
-        if(G_LIKELY(task))
-        {
-            char* uri;
-            const char* md5;
+/* should be called with queue lock held */
+static void queue_task(ThumbnailTask* task)
+{
+    task->serial = loader_queue_serial++;
+    task->iter = g_sequence_insert_sorted(loader_queue, task, compare_tasks, NULL);
+    g_thread_pool_push(loader_pool, GINT_TO_POINTER(1), NULL);
+}
 
-            task->locked = TRUE;
-            g_rec_mutex_unlock(&queue_lock);
-            uri = fm_path_to_uri(fm_file_info_get_path(task->fi));
+/* should be called with queue lock held */
+static ThumbnailTask* pop_queued_task(void)
+{
+    GSequenceIter* it = g_sequence_get_begin_iter(loader_queue);
+    ThumbnailTask* task;
 
-            /* generate filename for the thumbnail */
-            g_checksum_update(sum, (guchar*)uri, -1);
-            md5 = g_checksum_get_string(sum); /* md5 sum of the URI */
+    if(g_sequence_iter_is_end(it))
+        return NULL;
+    task = (ThumbnailTask*)g_sequence_get(it);
+    g_sequence_remove(it);
+    task->iter = NULL;
+    return task;
+}
 
-            task->uri = uri;
+/* should be called with queue lock held */
+/* moves the task in loader_queue if priority of its requests was changed */
+static void update_task_priority(ThumbnailTask* task)
+{
+    GList* l;
+    gint priority = G_MININT;
 
-            if (task->flags & LOAD_NORMAL)
-            {
-                memcpy( normal_basename, md5, 32 );
-                task->normal_path = normal_path;
-            }
-            if (task->flags & LOAD_LARGE)
-            {
-                memcpy( large_basename, md5, 32 );
-                task->large_path = large_path;
-            }
+    for(l = task->requests; l; l = l->next)
+    {
+        FmThumbnailLoader* req = (FmThumbnailLoader*)l->data;
+        if(!req->cancelled && req->priority > priority)
+            priority = req->priority;
+    }
+    if(priority == G_MININT || priority == task->priority)
+        return;
+    task->priority = priority;
+    if(task->iter)
+        g_sequence_sort_changed(task->iter, compare_tasks, NULL);
+}
 
-            if(task->flags & (GENERATE_NORMAL|GENERATE_LARGE))
-                generate_thumbnails(task); /* second cycle */
-            else
-                load_thumbnails(task); /* first cycle */
+/* in thread */
+static void load_thumbnail_task(gpointer data, gpointer unused)
+{
+    ThumbnailTask* task;
+    char *uri, *md5, *basename;
 
-            g_checksum_reset(sum);
-            task->uri = NULL;
-            task->normal_path = NULL;
-            task->large_path = NULL;
-            g_free(uri);
+    g_rec_mutex_lock(&queue_lock);
+    task = pop_queued_task();
+    if(G_UNLIKELY(!task)) /* the task was cancelled or the queue was cleared */
+    {
+        g_rec_mutex_unlock(&queue_lock);
+        return;
+    }
+    task->locked = TRUE;
+    loading = g_slist_prepend(loading, task);
+    g_rec_mutex_unlock(&queue_lock);
 
-            g_rec_mutex_lock(&queue_lock);
-            cur_loading = NULL;
+    uri = fm_path_to_uri(fm_file_info_get_path(task->fi));
+    /* generate filename for the thumbnail */
+    md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1); /* md5 sum of the URI */
+    basename = g_strconcat(md5, ".png", NULL);
+    g_free(md5);
+
+    task->uri = uri;
+    if (task->flags & LOAD_NORMAL)
+        task->normal_path = g_build_filename(thumb_dir, "normal", basename, NULL);
+    if (task->flags & LOAD_LARGE)
+        task->large_path = g_build_filename(thumb_dir, "large", basename, NULL);
+    g_free(basename);
+
+    if(task->flags & (GENERATE_NORMAL|GENERATE_LARGE))
+        generate_thumbnails(task); /* second cycle */
+    else
+        load_thumbnails(task); /* first cycle */
 
-            if(g_cancellable_is_cancelled(generator_cancellable))
-            {
-                DEBUG("generation of thumbnail is cancelled!");
-                g_cancellable_reset(generator_cancellable);
-            }
+    g_free(task->normal_path);
+    g_free(task->large_path);
+    task->uri = NULL;
+    task->normal_path = NULL;
+    task->large_path = NULL;
+    g_free(uri);
 
-            if(task->cancelled /* task is done */
-               || (task->flags & (GENERATE_NORMAL|GENERATE_LARGE)) == 0)
-                thumbnail_task_free(task);
-            else
-                g_queue_push_tail(&loader_queue, task); /* return it to regen */
+    g_rec_mutex_lock(&queue_lock);
+    loading = g_slist_remove(loading, task);
 
-            g_rec_mutex_unlock(&queue_lock);
-        }
-        else /* no task is left in the loader_queue */
-        {
-            g_free(normal_path);
-            g_free(large_path);
-            g_checksum_free(sum);
-#if GLIB_CHECK_VERSION(2, 32, 0)
-            g_thread_unref(loader_thread_id);
-#endif
-            loader_thread_id = NULL;
-            g_rec_mutex_unlock(&queue_lock);
-            return NULL;
-        }
-    }
+    if(task->cancelled /* task is done */
+       || (task->flags & (GENERATE_NORMAL|GENERATE_LARGE)) == 0)
+        thumbnail_task_free(task);
+    else
+        queue_task(task); /* return it to regen */
+
+    g_rec_mutex_unlock(&queue_lock);
 }
 
 /* should be called with queue locked */
@@ -524,7 +701,10 @@ inline static GObject* find_thumbnail_in_hash(FmPath* path, guint size)
         {
             ThumbnailCacheItem* item = (ThumbnailCacheItem*)l->data;
             if(item->size == size)
+            {
+                cache_item_touch(item);
                 return item->pix;
+            }
         }
     }
     return NULL;
@@ -532,12 +712,13 @@ inline static GObject* find_thumbnail_in_hash(FmPath* path, guint size)
 
 /* should be called with queue locked */
 /* may be called in thread */
-static ThumbnailTask* find_queued_task(GQueue* queue, FmFileInfo* fi)
+static ThumbnailTask* find_queued_task(GSequence* queue, FmFileInfo* fi)
 {
-    GList* l;
-    for( l = queue->head; l; l=l->next )
+    GSequenceIter* it;
+    for(it = g_sequence_get_begin_iter(queue); !g_sequence_iter_is_end(it);
+        it = g_sequence_iter_next(it))
     {
-        ThumbnailTask* task = (ThumbnailTask*)l->data;
+        ThumbnailTask* task = (ThumbnailTask*)g_sequence_get(it);
         /* if it's cancelled or processing then it's too late to add */
         if(task->cancelled || task->locked)
             continue;
@@ -585,6 +766,7 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
     req->task = NULL;
     req->done = FALSE;
     req->cancelled = FALSE;
+    req->priority = 0;
 
     DEBUG("request thumbnail: %s", fm_path_get_basename(src_path));
 
@@ -605,13 +787,35 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
     }
 
     /* if it's not cached, add it to the loader_queue for loading. */
-    task = find_queued_task(&loader_queue, src_file);
+    task = find_queued_task(loader_queue, src_file);
 
     if(!task)
     {
         task = g_slice_new0(ThumbnailTask);
         task->fi = fm_file_info_ref(src_file);
-        g_queue_push_tail(&loader_queue, task);
+        task->cancellable = g_cancellable_new();
+        if(G_UNLIKELY(!loader_pool))
+        {
+            char* dir;
+            guint n_threads;
+
+            /* ensure thumbnail directories exists */
+            dir = g_build_filename(thumb_dir, "normal", NULL);
+            g_mkdir_with_parents(dir, 0700);
+            g_free(dir);
+            dir = g_build_filename(thumb_dir, "large", NULL);
+            g_mkdir_with_parents(dir, 0700);
+            g_free(dir);
+            /* decoding and scaling is CPU bound so use every CPU */
+#if GLIB_CHECK_VERSION(2, 36, 0)
+            n_threads = CLAMP(g_get_num_processors(), 1, LOADER_MAX_THREADS);
+#else
+            n_threads = 2;
+#endif
+            loader_pool = g_thread_pool_new(load_thumbnail_task, NULL,
+                                            n_threads, FALSE, NULL);
+        }
+        queue_task(task);
     }
     else
     {
@@ -625,16 +829,7 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
         task->flags |= LOAD_NORMAL;
 
     task->requests = g_list_append(task->requests, req);
-
-    if(!loader_thread_id)
-#if GLIB_CHECK_VERSION(2, 32, 0)
-        loader_thread_id = g_thread_new("loader", load_thumbnail_thread, NULL);
-        /* we don't use loader_thread_id but Glib 2.32 crashes if we unref
-           GThread while it's in creation progress. It is a bug of GLib
-           certainly but as workaround we'll unref it in the thread itself */
-#else
-        loader_thread_id = g_thread_create( load_thumbnail_thread, NULL, FALSE, NULL);
-#endif
+    update_task_priority(task);
 
     g_rec_mutex_unlock(&queue_lock);
     return req;
@@ -654,6 +849,7 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
 void fm_thumbnail_loader_cancel(FmThumbnailLoader* req)
 {
     GList* l;
+    GSList* sl;
 
     g_return_if_fail(req != NULL);
 
@@ -671,25 +867,62 @@ void fm_thumbnail_loader_cancel(FmThumbnailLoader* req)
     }
     if(l == NULL)
     {
+        if(req->task->iter) /* nobody works on it so drop it right away */
+        {
+            ThumbnailTask* task = req->task;
+            g_sequence_remove(task->iter);
+            task->iter = NULL;
+            task->cancelled = TRUE;
+            thumbnail_task_free(task);
+            goto done;
+        }
         req->task->cancelled = TRUE;
-        if(req->task == cur_loading && generator_cancellable)
+        if(req->task->locked)
+            g_cancellable_cancel(req->task->cancellable);
+        for(sl = thumbnailers; sl; sl = sl->next)
         {
-            g_cancellable_cancel(generator_cancellable);
-            if(thumbnailer_pid > 0)
-                kill(thumbnailer_pid, SIGTERM);
-            thumbnailer_pid = -1;
-            if(thumbnailer_timeout_id)
+            ThumbnailerProcess* proc = (ThumbnailerProcess*)sl->data;
+            if(proc->task == req->task && proc->pid > 0)
             {
-                g_source_remove(thumbnailer_timeout_id);
-                thumbnailer_timeout_id = 0;
+                kill(proc->pid, SIGTERM);
+                proc->pid = -1;
             }
         }
+        /* it might wait for a thumbnailer to finish */
+        if(req->task->locked)
+            thumbnailer_slots_add(0);
     }
+    else
+        update_task_priority(req->task);
 
 done:
     g_rec_mutex_unlock(&queue_lock);
 }
 
+/**
+ * fm_thumbnail_loader_set_priority
+ * @req: the request descriptor
+ * @priority: new priority
+ *
+ * Changes priority of @req. Requests with higher priority are served
+ * before others, requests with the same priority are served in order
+ * they were made. Default priority is 0. This can be used to load
+ * thumbnails for visible items first.
+ *
+ * Since: 1.2.0
+ */
+/* in main loop */
+void fm_thumbnail_loader_set_priority(FmThumbnailLoader* req, gint priority)
+{
+    g_return_if_fail(req != NULL);
+
+    g_rec_mutex_lock(&queue_lock);
+    req->priority = priority;
+    if(req->task)
+        update_task_priority(req->task);
+    g_rec_mutex_unlock(&queue_lock);
+}
+
 /**
  * fm_thumbnail_loader_get_data
  * @req: request descriptor
@@ -745,24 +978,44 @@ void _fm_thumbnail_loader_init()
 {
     thumb_dir = g_build_filename(fm_get_home_dir(), ".thumbnails", NULL);
     hash = g_hash_table_new((GHashFunc)fm_path_hash, (GEqualFunc)fm_path_equal);
-    generator_cancellable = g_cancellable_new();
+    loader_queue = g_sequence_new(NULL);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    thumbnailer_slots_mutex = g_mutex_new();
+    thumbnailer_slots_cond = g_cond_new();
+#endif
+    /* thumbnailers are mostly CPU bound, leave some CPUs for the rest */
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    thumbnailer_slots = CLAMP(g_get_num_processors() / 2, 1, THUMBNAILER_MAX_PROCESSES);
+#else
+    thumbnailer_slots = 2;
+#endif
 }
 
 static gboolean fm_thumbnail_loader_cleanup(gpointer unused)
 {
     FmThumbnailLoader* req;
 
-    if(loader_thread_id)
+    if(loading)
         return TRUE;
-    /* loader_queue is empty and cur_loading is finished */
+    /* loader_queue is empty and all loading tasks are finished */
+    if(loader_pool)
+        g_thread_pool_free(loader_pool, TRUE, TRUE);
+    loader_pool = NULL;
+    g_sequence_free(loader_queue);
+    loader_queue = NULL;
     while((req = g_queue_pop_head(&ready_queue)))
         fm_thumbnail_loader_free(req);
+    recent_thumbnails_trim(0);
     g_hash_table_destroy(hash); /* caches will be destroyed by pixbufs */
     hash = NULL;
     g_free(thumb_dir);
     thumb_dir = NULL;
-    g_object_unref(generator_cancellable);
-    generator_cancellable = NULL;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_free(thumbnailer_slots_mutex);
+    thumbnailer_slots_mutex = NULL;
+    g_cond_free(thumbnailer_slots_cond);
+    thumbnailer_slots_cond = NULL;
+#endif
     return FALSE;
 }
 
@@ -770,16 +1023,27 @@ static gboolean fm_thumbnail_loader_cleanup(gpointer unused)
 void _fm_thumbnail_loader_finalize(void)
 {
     ThumbnailTask* task;
+    GSList* l;
 
     g_rec_mutex_lock(&queue_lock);
     /* cancel all pending requests before destroying hash */
-    if(cur_loading)
-        cur_loading->cancelled = TRUE;
-    if(generator_cancellable)
-        g_cancellable_cancel(generator_cancellable);
-    while((task = g_queue_pop_head(&loader_queue)))
+    for(l = loading; l; l = l->next)
+    {
+        task = (ThumbnailTask*)l->data;
+        task->cancelled = TRUE;
+        g_cancellable_cancel(task->cancellable);
+    }
+    for(l = thumbnailers; l; l = l->next)
+    {
+        ThumbnailerProcess* proc = (ThumbnailerProcess*)l->data;
+        if(proc->pid > 0)
+            kill(proc->pid, SIGTERM);
+        proc->pid = -1;
+    }
+    thumbnailer_slots_add(0);
+    while((task = pop_queued_task()))
         thumbnail_task_free(task);
-    /* if thread was alive it will die after that */
+    /* if threads were alive they will finish after that */
     g_rec_mutex_unlock(&queue_lock);
     g_timeout_add(10, fm_thumbnail_loader_cleanup, NULL);
 }
@@ -876,11 +1140,13 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
 
     DEBUG("generate thumbnail for %s", fm_file_info_get_name(task->fi));
 
-    ins = g_file_read(gf, generator_cancellable, NULL);
+    ins = g_file_read(gf, task->cancellable, NULL);
     if(ins)
     {
+        GInputStream* stream = G_INPUT_STREAM(ins);
         GObject* ori_pix = NULL;
         int rotate_degrees = 0;
+        int width = 0, height = 0; /* sizes of the original image */
 #ifdef USE_EXIF
         /* use libexif to extract thumbnails embedded in jpeg files */
         FmMimeType* mime_type = fm_file_info_get_mime_type(task->fi);
@@ -889,13 +1155,27 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
             /* try to extract thumbnails embedded in jpeg files */
             ExifLoader *exif_loader = exif_loader_new();
             ExifData *exif_data;
-            while(!g_cancellable_is_cancelled(generator_cancellable)) {
-                unsigned char buf[4096];
-                gssize read_size = g_input_stream_read((GInputStream*)ins, buf, 4096, generator_cancellable, NULL);
-                if(read_size == 0) /* EOF */
-                    break;
-                if(exif_loader_write(exif_loader, buf, read_size) == 0)
+            GBufferedInputStream* buffered;
+            gsize fed = 0;
+
+            /* bytes given to libexif are kept in the buffer and not consumed
+               so the image decoder can reuse them instead of reading again */
+            stream = g_buffered_input_stream_new_sized(stream, EXIF_BUFFER_SIZE);
+            g_object_unref(ins);
+            buffered = G_BUFFERED_INPUT_STREAM(stream);
+            while(!g_cancellable_is_cancelled(task->cancellable)) {
+                const guchar* buf;
+                gsize available;
+                gsize buf_size = g_buffered_input_stream_get_buffer_size(buffered);
+
+                if(g_buffered_input_stream_get_available(buffered) == buf_size)
+                    g_buffered_input_stream_set_buffer_size(buffered, buf_size * 2);
+                if(g_buffered_input_stream_fill(buffered, -1, task->cancellable, NULL) <= 0)
+                    break; /* EOF or error */
+                buf = g_buffered_input_stream_peek_buffer(buffered, &available);
+                if(exif_loader_write(exif_loader, (guchar*)buf + fed, available - fed) == 0)
                     break; /* no more EXIF data */
+                fed = available;
             }
             exif_data = exif_loader_get_data(exif_loader);
             exif_loader_unref(exif_loader);
@@ -930,47 +1210,39 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
                 {
                     /* load the embedded jpeg thumbnail */
                     GInputStream* mem_stream = g_memory_input_stream_new_from_data(exif_data->data, exif_data->size, NULL);
-                    ori_pix = backend.read_image_from_stream(mem_stream, exif_data->size, generator_cancellable);
+                    ori_pix = backend.read_image_from_stream(mem_stream, exif_data->size, task->cancellable);
                     g_object_unref(mem_stream);
                 }
                 exif_data_unref(exif_data);
             }
         }
 
-        if(!ori_pix)
+#endif
+        if(!ori_pix && backend.read_scaled_image_from_stream)
         {
-            /* FIXME: instead of reload the image file again, it's posisble to get the bytes
-             * read already by libexif with exif_loader_get_buf() and feed the data to
-             * GObjectLoader ourselves. However the performance improvement by doing this
-             * might be negliable, I think. */
-            GSeekable* seekable = G_SEEKABLE(ins);
-            if(g_seekable_can_seek(seekable))
-            {
-                /* an EXIF thumbnail is not found, lets rewind the file pointer to beginning of
-                 * the file and load the image with gdkpixbuf instead. */
-                g_seekable_seek(seekable, 0, G_SEEK_SET, generator_cancellable, NULL);
-            }
-            else
-            {
-                /* if the stream is not seekable, close it and open it again. */
-                g_input_stream_close(G_INPUT_STREAM(ins), NULL, NULL);
-                g_object_unref(ins);
-                ins = g_file_read(gf, generator_cancellable, NULL);
-            }
-            ori_pix = backend.read_image_from_stream(G_INPUT_STREAM(ins), fm_file_info_get_size(task->fi), generator_cancellable);
+            /* decode it at the biggest size required, both thumbnails
+               are made from it so the full size image is never decoded */
+            int size = (task->flags & GENERATE_LARGE) ? 256 : 128;
+            ori_pix = backend.read_scaled_image_from_stream(stream,
+                                            fm_file_info_get_size(task->fi),
+                                            size, size, &width, &height,
+                                            task->cancellable);
         }
-#else
-        ori_pix = backend.read_image_from_stream(G_INPUT_STREAM(ins), fm_file_info_get_size(task->fi), generator_cancellable);
-#endif
-        g_input_stream_close(G_INPUT_STREAM(ins), NULL, NULL);
-        g_object_unref(ins);
+        else if(!ori_pix)
+            ori_pix = backend.read_image_from_stream(stream, fm_file_info_get_size(task->fi), task->cancellable);
+        g_input_stream_close(stream, NULL, NULL);
+        g_object_unref(stream);
 
         if(ori_pix) /* if the original image is successfully loaded */
         {
-            int width = backend.get_image_width(ori_pix);
-            int height = backend.get_image_height(ori_pix);
             gboolean need_save;
 
+            if(width == 0 || height == 0) /* it wasn't scaled on decoding */
+            {
+                width = backend.get_image_width(ori_pix);
+                height = backend.get_image_height(ori_pix);
+            }
+
             if(task->flags & GENERATE_NORMAL)
             {
                 /* don't create thumbnails for images which are too small */
@@ -1011,7 +1283,7 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
                 if(rotate_degrees != 0)
                 {
                     GObject* rotated;
-                    rotated = backend.rotate_image(normal_pix, rotate_degrees);
+                    rotated = backend.rotate_image(large_pix, rotate_degrees);
                     g_object_unref(large_pix);
                     large_pix = rotated;
                 }
@@ -1035,63 +1307,115 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
 /* call from main thread */
 static gboolean on_thumbnailer_timeout(gpointer user_data)
 {
+    GPid pid = GPOINTER_TO_INT(user_data);
+    GSList* l;
+
     /* check if it is destroyed already */
     if(g_source_is_destroyed(g_main_current_source()))
         return FALSE;
     /* g_print("thumbnail timeout!\n"); */
     g_rec_mutex_lock(&queue_lock);
-    if(thumbnailer_pid > 0)
+    for(l = thumbnailers; l; l = l->next)
     {
-        kill(thumbnailer_pid, SIGTERM);
-        thumbnailer_pid = -1;
+        ThumbnailerProcess* proc = (ThumbnailerProcess*)l->data;
+        if(proc->pid == pid)
+        {
+            kill(pid, SIGTERM);
+            proc->pid = -1;
+            proc->timeout_id = 0;
+            break;
+        }
     }
-    thumbnailer_timeout_id = 0;
     g_rec_mutex_unlock(&queue_lock);
     return FALSE;
 }
 
+/* waits until another thumbnailer can be started,
+   returns FALSE if task was cancelled meanwhile */
+static gboolean thumbnailer_slot_acquire(ThumbnailTask* task)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex* mutex = &thumbnailer_slots_mutex;
+    GCond* cond = &thumbnailer_slots_cond;
+#else
+    GMutex* mutex = thumbnailer_slots_mutex;
+    GCond* cond = thumbnailer_slots_cond;
+#endif
+    gboolean ret;
+
+    g_mutex_lock(mutex);
+    while(thumbnailer_slots == 0 && !task->cancelled)
+        g_cond_wait(cond, mutex);
+    ret = !task->cancelled;
+    if(ret)
+        thumbnailer_slots--;
+    g_mutex_unlock(mutex);
+    return ret;
+}
+
+/* adds delta slots and wakes up threads waiting for them */
+static void thumbnailer_slots_add(guint delta)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex* mutex = &thumbnailer_slots_mutex;
+    GCond* cond = &thumbnailer_slots_cond;
+#else
+    GMutex* mutex = thumbnailer_slots_mutex;
+    GCond* cond = thumbnailer_slots_cond;
+#endif
+
+    g_mutex_lock(mutex);
+    thumbnailer_slots += delta;
+    /* wake up every waiting thread so cancelled ones can leave as well */
+    g_cond_broadcast(cond);
+    g_mutex_unlock(mutex);
+}
+
 /* call from the thumbnail thread */
-static gboolean run_thumbnailer(FmThumbnailer* thumbnailer, const char* uri, const char* output_file, guint size)
+static gboolean run_thumbnailer(ThumbnailTask* task, FmThumbnailer* thumbnailer, const char* uri, const char* output_file, guint size)
 {
     /* g_print("run_thumbnailer: uri: %s\n", uri); */
     int status;
-    GPid _pid = fm_thumbnailer_launch_for_uri_async(thumbnailer, uri,
-                                                    output_file, size, NULL);
-    if(_pid <= 0) /* failed to launch */
+    GPid pid;
+    ThumbnailerProcess proc;
+
+    if(!thumbnailer_slot_acquire(task))
+        return FALSE;
+    pid = fm_thumbnailer_launch_for_uri_async(thumbnailer, uri,
+                                              output_file, size, NULL);
+    if(pid <= 0) /* failed to launch */
+    {
+        thumbnailer_slots_add(1);
         /* FIXME: print error message from failed thumbnailer */
         return FALSE;
+    }
+    proc.pid = pid;
+    proc.task = task;
     g_rec_mutex_lock(&queue_lock);
-    if(thumbnailer_pid != -1)
+    if(task->cancelled) /* it was cancelled while launching */
     {
-        g_rec_mutex_unlock(&queue_lock);
-        g_critical("libfm: run_thumbnailer() concurrent process attempt");
-        kill(_pid, SIGTERM);
-        return FALSE;
+        kill(pid, SIGTERM);
+        proc.pid = -1;
+        proc.timeout_id = 0;
     }
-    thumbnailer_pid = _pid;
-    thumbnailer_timeout_id = g_timeout_add_seconds(THUMBNAILER_TIMEOUT_SEC,
-                                                   on_thumbnailer_timeout, NULL);
-    /* g_print("pid: %d\n", thumbnailer_pid); */
+    else
+        proc.timeout_id = g_timeout_add_seconds(THUMBNAILER_TIMEOUT_SEC,
+                                                on_thumbnailer_timeout,
+                                                GINT_TO_POINTER(pid));
+    /* g_print("pid: %d\n", pid); */
+    thumbnailers = g_slist_prepend(thumbnailers, &proc);
     g_rec_mutex_unlock(&queue_lock);
 
     /* wait for the thumbnailer process to terminate */
-    waitpid(_pid, &status, 0);
+    waitpid(pid, &status, 0);
     /* the process is terminated */
     g_rec_mutex_lock(&queue_lock);
-    /* thumbnailer_pid can be only this one or -1 if terminated */
-    if(thumbnailer_pid == _pid)
-    {
-        thumbnailer_pid = -1;
-        if(thumbnailer_timeout_id)
-        {
-            g_source_remove(thumbnailer_timeout_id);
-            thumbnailer_timeout_id = 0;
-        }
-    }
-    else if(thumbnailer_pid != -1) /* it's error otherwise */
-        g_critical("libfm: run_thumbnailer() concurrent process");
+    thumbnailers = g_slist_remove(thumbnailers, &proc);
+    if(proc.timeout_id)
+        g_source_remove(proc.timeout_id);
     g_rec_mutex_unlock(&queue_lock);
-    return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    thumbnailer_slots_add(1);
+    return (proc.pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
 }
 
 /* in thread */
@@ -1101,9 +1425,6 @@ static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task)
     GObject* normal_pix = NULL;
     GObject* large_pix = NULL;
     FmMimeType* mime_type = fm_file_info_get_mime_type(task->fi);
-    /* TODO: we need to add timeout for external thumbnailers.
-     * If a thumbnailer program is broken or locked for unknown reason,
-     * the thumbnailer process should be killed once a timeout is reached. */
     if(mime_type)
     {
         const GList* thumbnailers = fm_mime_type_get_thumbnailers(mime_type);
@@ -1114,7 +1435,7 @@ static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task)
             FmThumbnailer* thumbnailer = FM_THUMBNAILER(l->data);
             if((task->flags & GENERATE_NORMAL) && !(generated & GENERATE_NORMAL))
             {
-                if(run_thumbnailer(thumbnailer, task->uri, task->normal_path, 128))
+                if(run_thumbnailer(task, thumbnailer, task->uri, task->normal_path, 128))
                 {
                     generated |= GENERATE_NORMAL;
                     normal_pix = backend.read_image_from_file(task->normal_path);
@@ -1122,10 +1443,10 @@ static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task)
             }
             if((task->flags & GENERATE_LARGE) && !(generated & GENERATE_LARGE))
             {
-                if(run_thumbnailer(thumbnailer, task->uri, task->large_path, 256))
+                if(run_thumbnailer(task, thumbnailer, task->uri, task->large_path, 256))
                 {
                     generated |= GENERATE_LARGE;
-                    large_pix = backend.read_image_from_file(task->normal_path);
+                    large_pix = backend.read_image_from_file(task->large_path);
                 }
             }
 
@@ -62,6 +62,8 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
 
 void fm_thumbnail_loader_cancel(FmThumbnailLoader* req);
 
+void fm_thumbnail_loader_set_priority(FmThumbnailLoader* req, gint priority);
+
 GObject* fm_thumbnail_loader_get_data(FmThumbnailLoader* req);
 
 FmFileInfo* fm_thumbnail_loader_get_file_info(FmThumbnailLoader* req);
@@ -82,6 +84,9 @@ typedef struct _FmThumbnailLoaderBackend FmThumbnailLoaderBackend;
  * @get_image_width: callback to retrieve width from image
  * @get_image_height: callback to retrieve height from image
  * @get_image_text: callback to retrieve custom attributes text from image
+ * @read_scaled_image_from_stream: (allow-none): callback to read image by
+ *      opened #GInputStream scaled down while decoding to fit into given
+ *      width and height, it also returns original sizes of the image
  *
  * Abstract backend callbacks list.
  */
@@ -94,6 +99,10 @@ struct _FmThumbnailLoaderBackend {
     int (*get_image_width)(GObject* image);
     int (*get_image_height)(GObject* image);
     char* (*get_image_text)(GObject* image, const char* key);
+    GObject* (*read_scaled_image_from_stream)(GInputStream* stream, guint64 len,
+                                              int max_width, int max_height,
+                                              int* orig_width, int* orig_height,
+                                              GCancellable* cancellable);
     // const char* (*get_image_orientation)(GObject* image);
     // GObject* (*apply_orientation)(GObject* image);
 };
@@ -28,13 +28,27 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "fm-thumbnailer.h"
 #include "fm-mime-type.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* scheduling priority of thumbnailer processes */
+#define THUMBNAILER_NICE            10
+/* max size of data segment of thumbnailer process, in megabytes */
+#define THUMBNAILER_MAX_MEMORY      1024
 
 struct _FmThumbnailer
 {
@@ -210,6 +224,32 @@ char* fm_thumbnailer_command_for_uri(FmThumbnailer* thumbnailer, const char* uri
     return NULL;
 }
 
+/* runs in the child process before exec so should not allocate memory */
+static void thumbnailer_child_setup(gpointer unused)
+{
+#ifdef RLIMIT_DATA
+    struct rlimit rl;
+#endif
+
+    /* thumbnailers run in background so should not slow down the desktop */
+    setpriority(PRIO_PROCESS, 0, THUMBNAILER_NICE);
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+#ifdef RLIMIT_DATA
+    /* broken thumbnailer should not eat all the memory */
+    if(getrlimit(RLIMIT_DATA, &rl) == 0 &&
+       (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > (rlim_t)THUMBNAILER_MAX_MEMORY << 20))
+    {
+        rl.rlim_cur = (rlim_t)THUMBNAILER_MAX_MEMORY << 20;
+        if(rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+            rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_DATA, &rl);
+    }
+#endif
+}
+
 /**
  * fm_thumbnailer_launch_for_uri_async
  * @thumbnailer: thumbnailer descriptor
@@ -219,6 +259,8 @@ char* fm_thumbnailer_command_for_uri(FmThumbnailer* thumbnailer, const char* uri
  * @error: (allow-none) (out): location to save error
  *
  * Tries to spawn thumbnailer to generate new thumbnail for given @uri.
+ * The process is ran with lowered CPU and I/O priority and its memory
+ * usage is limited where the system supports that.
  *
  * Returns: thumbnailer process ID or -1 in case of failure.
  *
@@ -240,7 +282,7 @@ GPid fm_thumbnailer_launch_for_uri_async(FmThumbnailer* thumbnailer,
         {
             g_spawn_async("/", argv, NULL,
                 G_SPAWN_SEARCH_PATH|G_SPAWN_STDOUT_TO_DEV_NULL|G_SPAWN_DO_NOT_REAP_CHILD,
-                NULL, NULL, &pid, error);
+                thumbnailer_child_setup, NULL, &pid, error);
             g_strfreev(argv);
         }
         /* g_print("pid = %d, %s", pid, cmd_line); */
@@ -0,0 +1,338 @@
+/*
+ *      fm-trash.c
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:fm-trash
+ * @short_description: Trash cans of the user.
+ * @title: Trash
+ *
+ * @include: libfm/fm.h
+ *
+ * These functions find local trash cans of the user as described by the
+ * freedesktop.org Trash specification and return their totals without
+ * querying trash:/// with GIO. The totals are cached and the trash can is
+ * recounted only after its content was changed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fm-trash.h"
+#include <gio/gunixmounts.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+    time_t info_mtime; /* modification times when it was counted */
+    time_t files_mtime;
+    time_t counted; /* when it was counted */
+    guint serial; /* changed each time it is counted */
+    guint n_items;
+    goffset size; /* -1 if it isn't calculated yet */
+} FmTrashCan;
+
+static GHashTable* trash_cans = NULL; /* path -> FmTrashCan */
+static GSList* mount_points = NULL; /* topdirs which may contain trash cans */
+static guint64 mounts_time = 0;
+
+G_LOCK_DEFINE_STATIC(trash);
+
+static void trash_can_free(gpointer data)
+{
+    g_slice_free(FmTrashCan, data);
+}
+
+static void update_mount_points(void)
+{
+    GList *mounts, *l;
+
+    if(mounts_time != 0 && !g_unix_mounts_changed_since(mounts_time))
+        return;
+    g_slist_foreach(mount_points, (GFunc)g_free, NULL);
+    g_slist_free(mount_points);
+    mount_points = NULL;
+    mounts = g_unix_mounts_get(&mounts_time);
+    for(l = mounts; l; l = l->next)
+    {
+        GUnixMountEntry* mount = (GUnixMountEntry*)l->data;
+        const char* path = g_unix_mount_get_mount_path(mount);
+        if(!g_unix_mount_is_system_internal(mount) &&
+           !g_slist_find_custom(mount_points, path, (GCompareFunc)strcmp))
+            mount_points = g_slist_prepend(mount_points, g_strdup(path));
+        g_unix_mount_free(mount);
+    }
+    g_list_free(mounts);
+}
+
+/* adds path to the list if it's a trash can of the user */
+static GSList* add_trash_can(GSList* list, char* path, uid_t uid)
+{
+    struct stat st;
+
+    if(lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == uid)
+        return g_slist_prepend(list, path);
+    g_free(path);
+    return list;
+}
+
+static GSList* trash_list_dirs(void)
+{
+    GSList *list, *l;
+    uid_t uid = getuid();
+    char uid_str[16];
+    struct stat st;
+
+    g_snprintf(uid_str, sizeof(uid_str), "%u", (guint)uid);
+    update_mount_points();
+    list = NULL;
+    for(l = mount_points; l; l = l->next)
+    {
+        const char* topdir = (const char*)l->data;
+        char* path = g_build_filename(topdir, ".Trash", NULL);
+        char* name;
+
+        /* $topdir/.Trash/$uid is used only if $topdir/.Trash is sticky */
+        if(lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && (st.st_mode & S_ISVTX))
+            list = add_trash_can(list, g_build_filename(path, uid_str, NULL), uid);
+        g_free(path);
+        name = g_strconcat(".Trash-", uid_str, NULL);
+        list = add_trash_can(list, g_build_filename(topdir, name, NULL), uid);
+        g_free(name);
+    }
+    /* the home trash is always the first */
+    return add_trash_can(list, g_build_filename(g_get_user_data_dir(), "Trash", NULL), uid);
+}
+
+#ifdef HAVE_FDOPENDIR
+/* returns total size of files in the folder opened as dfd and closes it */
+static goffset tree_size(int dfd)
+{
+    DIR* dir = fdopendir(dfd);
+    struct dirent* de;
+    struct stat st;
+    goffset size = 0;
+
+    if(!dir)
+    {
+        close(dfd);
+        return 0;
+    }
+    while((de = readdir(dir)) != NULL)
+    {
+        const char* name = de->d_name;
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if(fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        if(S_ISDIR(st.st_mode))
+        {
+            int fd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if(fd >= 0)
+                size += tree_size(fd);
+        }
+        else
+            size += st.st_size;
+    }
+    closedir(dir);
+    return size;
+}
+#endif
+
+/* returns cached totals for the trash can at path, recounts items if the
+   trash can was changed since the last time or in the same second */
+static FmTrashCan* trash_can_update(const char* path)
+{
+    FmTrashCan* can;
+    char *info_path, *files_path;
+    struct stat info_st, files_st;
+    GDir* dir;
+
+    if(G_UNLIKELY(!trash_cans))
+        trash_cans = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           trash_can_free);
+    can = (FmTrashCan*)g_hash_table_lookup(trash_cans, path);
+    if(!can)
+    {
+        can = g_slice_new0(FmTrashCan);
+        g_hash_table_insert(trash_cans, g_strdup(path), can);
+    }
+    info_path = g_build_filename(path, "info", NULL);
+    files_path = g_build_filename(path, "files", NULL);
+    if(stat(info_path, &info_st) < 0 || stat(files_path, &files_st) < 0)
+    {
+        can->counted = 0;
+        can->n_items = 0;
+        can->size = 0;
+    }
+    else if(can->counted == 0 || info_st.st_mtime != can->info_mtime ||
+            files_st.st_mtime != can->files_mtime || can->info_mtime >= can->counted ||
+            can->files_mtime >= can->counted)
+    {
+        can->info_mtime = info_st.st_mtime;
+        can->files_mtime = files_st.st_mtime;
+        can->counted = time(NULL);
+        can->serial++;
+        can->n_items = 0;
+        can->size = -1;
+        dir = g_dir_open(info_path, 0, NULL);
+        if(dir)
+        {
+            const char* name;
+            while((name = g_dir_read_name(dir)) != NULL)
+                if(g_str_has_suffix(name, ".trashinfo"))
+                    can->n_items++;
+            g_dir_close(dir);
+        }
+    }
+    g_free(info_path);
+    g_free(files_path);
+    return can;
+}
+
+/**
+ * fm_trash_list_dirs
+ *
+ * Finds trash cans of the current user: the home trash and trash cans
+ * in top folders of mounted local filesystems. Each trash can contains
+ * the files and info folders.
+ *
+ * Returns: (transfer full) (element-type char*): list of paths, the home
+ * trash is the first one if it exists. Free each path with g_free() and the list with
+ * g_slist_free() after usage.
+ *
+ * Since: 1.2.0
+ */
+GSList* fm_trash_list_dirs(void)
+{
+    GSList* list;
+
+    G_LOCK(trash);
+    list = trash_list_dirs();
+    G_UNLOCK(trash);
+    return list;
+}
+
+/**
+ * fm_trash_get_item_count
+ * @n_items: (out): location to store the number of items
+ *
+ * Retrieves number of items in all local trash cans of the user. This is
+ * much cheaper than query of %G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT since
+ * the trash can is recounted only after it was changed.
+ *
+ * Returns: %FALSE if some trash can cannot be read.
+ *
+ * Since: 1.2.0
+ */
+gboolean fm_trash_get_item_count(guint* n_items)
+{
+    GSList *dirs, *l;
+    gboolean ret = TRUE;
+    guint n = 0;
+
+    G_LOCK(trash);
+    dirs = trash_list_dirs();
+    for(l = dirs; l; l = l->next)
+    {
+        FmTrashCan* can = trash_can_update(l->data);
+        if(can->counted == 0) /* no files or info folder in it */
+            ret = FALSE;
+        n += can->n_items;
+        g_free(l->data);
+    }
+    G_UNLOCK(trash);
+    g_slist_free(dirs);
+    *n_items = n;
+    return ret;
+}
+
+/**
+ * fm_trash_get_size
+ * @size: (out): location to store the size
+ *
+ * Retrieves total size of files in all local trash cans of the user. The
+ * size is calculated only for trash cans changed since the last call so
+ * it may take a while if a big folder was trashed.
+ *
+ * Returns: %FALSE if the size cannot be calculated.
+ *
+ * Since: 1.2.0
+ */
+gboolean fm_trash_get_size(goffset* size)
+{
+#ifdef HAVE_FDOPENDIR
+    GSList *dirs, *l;
+    FmTrashCan* can;
+    goffset total = 0, can_size;
+    gboolean ret = TRUE;
+    guint serial;
+
+    G_LOCK(trash);
+    dirs = trash_list_dirs();
+    G_UNLOCK(trash);
+    for(l = dirs; l; l = l->next)
+    {
+        G_LOCK(trash);
+        can = trash_can_update(l->data);
+        serial = can->serial;
+        can_size = can->size;
+        if(can->counted == 0) /* no files or info folder in it */
+            ret = FALSE;
+        G_UNLOCK(trash);
+        if(can_size < 0)
+        {
+            /* the trash can is walked without the lock so the item count
+               isn't blocked meanwhile */
+            char* files_path = g_build_filename(l->data, "files", NULL);
+            int fd = open(files_path, O_RDONLY | O_DIRECTORY);
+            g_free(files_path);
+            if(fd >= 0)
+            {
+                can_size = tree_size(fd);
+                G_LOCK(trash);
+                /* it's not valid if the trash can was changed meanwhile */
+                can = trash_can_update(l->data);
+                if(can->serial == serial)
+                    can->size = can_size;
+                G_UNLOCK(trash);
+                total += can_size;
+            }
+            else
+                ret = FALSE;
+        }
+        else
+            total += can_size;
+        g_free(l->data);
+    }
+    g_slist_free(dirs);
+    *size = total;
+    return ret;
+#else
+    return FALSE;
+#endif
+}
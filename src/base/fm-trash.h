@@ -0,0 +1,35 @@
+/*
+ *      fm-trash.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_TRASH_H__
+#define __FM_TRASH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+GSList* fm_trash_list_dirs(void);
+gboolean fm_trash_get_item_count(guint* n_items);
+gboolean fm_trash_get_size(goffset* size);
+
+G_END_DECLS
+
+#endif /* __FM_TRASH_H__ */
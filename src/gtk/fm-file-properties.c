@@ -203,7 +203,6 @@ struct _FmFilePropData
     gint32 uid;
     gint32 gid;
 
-    guint timeout;
     FmDeepCountJob* dc_job;
 
     GSList *ext; /* elements: FmFilePropExt */
@@ -475,18 +474,11 @@ static gboolean _icon_press_event(GtkWidget *widget, GdkEventKey *event,
 
 
 /* ---- all other handlers ---- */
-static gboolean on_timeout(gpointer user_data)
+static void update_totals(FmFilePropData* data)
 {
-    FmFilePropData* data = (FmFilePropData*)user_data;
     char size_str[128];
     FmDeepCountJob* dc;
 
-    GDK_THREADS_ENTER();
-    if(g_source_is_destroyed(g_main_current_source()))
-    {
-        GDK_THREADS_LEAVE();
-        return FALSE;
-    }
     dc = data->dc_job;
     if(G_LIKELY(dc && !fm_job_is_cancelled(FM_JOB(dc))))
     {
@@ -509,18 +501,21 @@ static gboolean on_timeout(gpointer user_data)
         gtk_label_set_text(data->size_on_disk, str);
         g_free(str);
     }
+}
+
+static void on_progress(FmDeepCountJob* job, FmFilePropData* data)
+{
+    GDK_THREADS_ENTER();
+    update_totals(data); /* show the size counted so far */
     GDK_THREADS_LEAVE();
-    return TRUE;
 }
 
 static void on_finished(FmDeepCountJob* job, FmFilePropData* data)
 {
-    on_timeout(data); /* update display */
-    if(data->timeout)
-    {
-        g_source_remove(data->timeout);
-        data->timeout = 0;
-    }
+    GDK_THREADS_ENTER();
+    update_totals(data); /* update display */
+    GDK_THREADS_LEAVE();
+    g_signal_handlers_disconnect_by_func(data->dc_job, on_progress, data);
     g_object_unref(data->dc_job);
     data->dc_job = NULL;
 }
@@ -530,12 +525,11 @@ static void fm_file_prop_data_free(FmFilePropData* data)
     g_free(data->orig_owner);
     g_free(data->orig_group);
 
-    if(data->timeout)
-        g_source_remove(data->timeout);
     if(data->dc_job) /* FIXME: check if it's running */
     {
         fm_job_cancel(FM_JOB(data->dc_job));
         g_signal_handlers_disconnect_by_func(data->dc_job, on_finished, data);
+        g_signal_handlers_disconnect_by_func(data->dc_job, on_progress, data);
         g_object_unref(data->dc_job);
     }
     if(data->mime_type)
@@ -1326,7 +1320,7 @@ static void update_ui(FmFilePropData* data)
 
     update_permissions(data);
 
-    on_timeout(data);
+    update_totals(data);
 }
 
 static void init_application_list(FmFilePropData* data)
@@ -1373,7 +1367,7 @@ GtkDialog* fm_file_properties_widget_new(FmFileInfoList* files, gboolean topleve
     if(data->single_type)
         data->mime_type = fm_mime_type_ref(fm_file_info_get_mime_type(data->fi));
     paths = fm_path_list_new_from_file_info_list(files);
-    data->dc_job = fm_deep_count_job_new(paths, FM_DC_JOB_DEFAULT);
+    data->dc_job = fm_deep_count_job_new(paths, FM_DC_JOB_USE_CACHE);
     fm_path_list_unref(paths);
     data->ext = NULL; /* no extension by default */
     data->extdata = NULL;
@@ -1428,10 +1422,10 @@ GtkDialog* fm_file_properties_widget_new(FmFileInfoList* files, gboolean topleve
 
     init_application_list(data);
 
-    data->timeout = g_timeout_add(600, on_timeout, data);
     g_signal_connect(dlg, "response", G_CALLBACK(on_response), data);
     g_signal_connect_swapped(dlg, "destroy", G_CALLBACK(fm_file_prop_data_free), data);
     g_signal_connect(data->dc_job, "finished", G_CALLBACK(on_finished), data);
+    g_signal_connect(data->dc_job, "progress", G_CALLBACK(on_progress), data);
 
     g_signal_connect(data->icon_eventbox, "button-press-event",
                      G_CALLBACK(_icon_click_event), data);
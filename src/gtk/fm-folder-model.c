@@ -1599,6 +1599,74 @@ guint fm_folder_model_get_icon_size(FmFolderModel* model)
     return model->icon_size;
 }
 
+/* priorities of thumbnail requests by distance from visible rows */
+#define THUMBNAIL_PRIORITY_VISIBLE  1
+#define THUMBNAIL_PRIORITY_NEAR     0 /* within one screen, also for new ones */
+#define THUMBNAIL_PRIORITY_FAR      -1
+/* requests further than this number of screens are cancelled */
+#define THUMBNAIL_CANCEL_SCREENS    4
+
+/**
+ * fm_folder_model_set_visible_range
+ * @model: the folder model instance
+ * @start_path: first visible row
+ * @end_path: last visible row
+ *
+ * Informs @model which rows are visible in the view now. Thumbnails for
+ * visible rows are loaded first, then for rows near them. Requests for
+ * rows far away from the visible ones are cancelled, thumbnails for them
+ * will be requested again when they will be shown.
+ *
+ * Since: 1.2.0
+ */
+void fm_folder_model_set_visible_range(FmFolderModel* model, GtkTreePath* start_path,
+                                       GtkTreePath* end_path)
+{
+    GList *l, *next;
+    gint first, last, n_visible;
+
+    g_return_if_fail(start_path != NULL && end_path != NULL);
+
+    first = gtk_tree_path_get_indices(start_path)[0];
+    last = gtk_tree_path_get_indices(end_path)[0];
+    n_visible = last - first + 1;
+    if(n_visible <= 0)
+        return;
+    for(l = model->thumbnail_requests; l; l = next)
+    {
+        FmThumbnailRequest* req = (FmThumbnailRequest*)l->data;
+        GSequenceIter* seq_it;
+        FmFolderItem* item;
+        gint pos, distance;
+
+        next = l->next;
+        seq_it = g_hash_table_lookup(model->items_hash,
+                                     fm_thumbnail_request_get_file_info(req));
+        if(!seq_it || g_sequence_iter_get_sequence(seq_it) != model->items)
+            continue; /* it's hidden by filter */
+        pos = g_sequence_iter_get_position(seq_it);
+        if(pos < first)
+            distance = first - pos;
+        else if(pos > last)
+            distance = pos - last;
+        else
+            distance = 0;
+        if(distance == 0)
+            fm_thumbnail_loader_set_priority(req, THUMBNAIL_PRIORITY_VISIBLE);
+        else if(distance <= n_visible)
+            fm_thumbnail_loader_set_priority(req, THUMBNAIL_PRIORITY_NEAR);
+        else if(distance <= n_visible * THUMBNAIL_CANCEL_SCREENS)
+            fm_thumbnail_loader_set_priority(req, THUMBNAIL_PRIORITY_FAR);
+        else
+        {
+            fm_thumbnail_request_cancel(req);
+            model->thumbnail_requests = g_list_delete_link(model->thumbnail_requests, l);
+            item = (FmFolderItem*)g_sequence_get(seq_it);
+            item->thumbnail_loading = FALSE;
+        }
+    }
+}
+
 static void on_show_thumbnail_changed(FmConfig* cfg, gpointer user_data)
 {
     FmFolderModel* model = (FmFolderModel*)user_data;
@@ -151,6 +151,8 @@ gboolean fm_folder_model_find_iter_by_filename( FmFolderModel* model, GtkTreeIte
 void fm_folder_model_set_icon_size(FmFolderModel* model, guint icon_size);
 guint fm_folder_model_get_icon_size(FmFolderModel* model);
 
+void fm_folder_model_set_visible_range(FmFolderModel* model, GtkTreePath* start_path, GtkTreePath* end_path);
+
 void fm_folder_model_add_filter(FmFolderModel* model, FmFolderModelFilterFunc func, gpointer user_data);
 void fm_folder_model_remove_filter(FmFolderModel* model, FmFolderModelFilterFunc func, gpointer user_data);
 void fm_folder_model_apply_filters(FmFolderModel* model);
@@ -44,6 +44,8 @@
 #include "fm-config.h"
 #include "fm-monitor.h"
 #include "fm-file-info-job.h"
+#include "fm-simple-job.h"
+#include "fm-trash.h"
 
 /* standard items order */
 typedef enum
@@ -83,6 +85,7 @@ struct _FmPlacesModel
     GtkTreeRowReference* trash;
     GFileMonitor* trash_monitor;
     guint trash_idle_handler;
+    FmJob* trash_job; /* counts items in trash can */
     guint theme_change_handler;
     guint use_trash_change_handler;
     guint pane_icon_size_change_handler;
@@ -614,6 +617,92 @@ static void on_bookmarks_changed(FmBookmarks* bm, gpointer user_data)
     }
 }
 
+typedef struct
+{
+    FmPlacesModel* model;
+    guint n_items;
+    gboolean counted;
+} FmTrashCount;
+
+static void free_trash_count(gpointer data)
+{
+    g_slice_free(FmTrashCount, data);
+}
+
+/* in thread */
+static gboolean count_trash_items(FmJob* job, gpointer user_data)
+{
+    FmTrashCount* cnt = (FmTrashCount*)user_data;
+    GFileInfo* inf;
+    GFile* gf;
+
+    /* cached count of local trash cans is much cheaper than query, but
+       still may take a while on network mounts so it's not done in the
+       main thread either */
+    if(fm_trash_get_item_count(&cnt->n_items))
+        cnt->counted = TRUE;
+    else if(!fm_job_is_cancelled(job))
+    {
+        gf = fm_file_new_for_uri("trash:///");
+        inf = g_file_query_info(gf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT, 0,
+                                fm_job_get_cancellable(job), NULL);
+        g_object_unref(gf);
+        if(inf)
+        {
+            cnt->n_items = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT);
+            cnt->counted = TRUE;
+            g_object_unref(inf);
+        }
+    }
+    return cnt->counted;
+}
+
+static void on_trash_count_finished(FmJob* job, FmTrashCount* cnt)
+{
+    FmPlacesModel* model = cnt->model;
+    FmIcon* icon;
+    const char* icon_name;
+    FmPlacesItem* item = NULL;
+    GdkPixbuf* pix;
+    GtkTreePath* tp;
+    GtkTreeIter it;
+
+    g_signal_handlers_disconnect_by_func(job, on_trash_count_finished, cnt);
+    if(model->trash_job == job)
+        model->trash_job = NULL;
+    if(fm_job_is_cancelled(job) || !cnt->counted || !model->trash)
+        goto _end;
+    tp = gtk_tree_row_reference_get_path(model->trash);
+    if(!tp) /* FIXME: how can tp be invalid here? */
+        goto _end;
+    icon_name = cnt->n_items > 0 ? "user-trash-full" : "user-trash";
+    icon = fm_icon_from_name(icon_name);
+    gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &it, tp);
+    gtk_tree_model_get(GTK_TREE_MODEL(model), &it, FM_PLACES_MODEL_COL_INFO, &item, -1);
+    if(item->icon)
+        g_object_unref(item->icon);
+    item->icon = icon;
+    /* update the icon */
+    pix = fm_pixbuf_from_icon(item->icon, fm_config->pane_icon_size);
+    gtk_list_store_set(GTK_LIST_STORE(model), &it, FM_PLACES_MODEL_COL_ICON, pix, -1);
+    g_object_unref(pix);
+    gtk_tree_path_free(tp);
+_end:
+    g_object_unref(job);
+}
+
+static void cancel_trash_count(FmPlacesModel* model)
+{
+    if(model->trash_job)
+    {
+        g_signal_handlers_disconnect_matched(model->trash_job, G_SIGNAL_MATCH_FUNC,
+                                             0, 0, NULL, (gpointer)on_trash_count_finished, NULL);
+        fm_job_cancel(model->trash_job);
+        g_object_unref(model->trash_job);
+        model->trash_job = NULL;
+    }
+}
+
 static gboolean update_trash_item(gpointer user_data)
 {
     FmPlacesModel* model = FM_PLACES_MODEL(user_data);
@@ -621,37 +710,22 @@ static gboolean update_trash_item(gpointer user_data)
     if(!g_source_is_destroyed(g_main_current_source()) &&
        fm_config->use_trash && model->trash)
     {
-        GFile* gf = fm_file_new_for_uri("trash:///");
-        GFileInfo* inf = g_file_query_info(gf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT, 0, NULL, NULL);
-        g_object_unref(gf);
-        if(inf)
+        FmTrashCount* cnt = g_slice_new0(FmTrashCount);
+        FmJob* job;
+
+        /* the previous count is outdated already */
+        cancel_trash_count(model);
+        cnt->model = model;
+        job = fm_simple_job_new(count_trash_items, cnt, free_trash_count);
+        g_signal_connect(job, "finished", G_CALLBACK(on_trash_count_finished), cnt);
+        model->trash_job = job;
+        if(!fm_job_run_async(job))
         {
-            FmIcon* icon;
-            const char* icon_name;
-            FmPlacesItem* item = NULL;
-            GdkPixbuf* pix;
-            GtkTreePath* tp = gtk_tree_row_reference_get_path(model->trash);
-            GtkTreeIter it;
-            guint32 n = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT);
-
-            g_object_unref(inf);
-            if(!tp) /* FIXME: how can tp be invalid here? */
-                goto _end;
-            icon_name = n > 0 ? "user-trash-full" : "user-trash";
-            icon = fm_icon_from_name(icon_name);
-            gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &it, tp);
-            gtk_tree_model_get(GTK_TREE_MODEL(model), &it, FM_PLACES_MODEL_COL_INFO, &item, -1);
-            if(item->icon)
-                g_object_unref(item->icon);
-            item->icon = icon;
-            /* update the icon */
-            pix = fm_pixbuf_from_icon(item->icon, fm_config->pane_icon_size);
-            gtk_list_store_set(GTK_LIST_STORE(model), &it, FM_PLACES_MODEL_COL_ICON, pix, -1);
-            g_object_unref(pix);
-            gtk_tree_path_free(tp);
+            g_signal_handlers_disconnect_by_func(job, on_trash_count_finished, cnt);
+            model->trash_job = NULL;
+            g_object_unref(job);
         }
     }
-_end:
     GDK_THREADS_LEAVE();
     return FALSE;
 }
@@ -723,6 +797,7 @@ static void on_use_trash_changed(FmConfig* cfg, gpointer user_data)
             g_source_remove(model->trash_idle_handler);
             model->trash_idle_handler = 0;
         }
+        cancel_trash_count(model);
     }
 }
 
@@ -1207,6 +1282,7 @@ static void fm_places_model_dispose(GObject *object)
         g_source_remove(self->trash_idle_handler);
         self->trash_idle_handler = 0;
     }
+    cancel_trash_count(self);
 
     if(self->eject_icon)
         g_object_unref(self->eject_icon);
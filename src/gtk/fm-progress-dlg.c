@@ -34,6 +34,8 @@
 
 #include "fm-progress-dlg.h"
 #include "fm-gtk-utils.h"
+#include "fm-config.h"
+#include "fm-utils.h"
 #include <glib/gi18n-lib.h>
 
 #define SHOW_DLG_DELAY  1000
@@ -89,32 +91,46 @@ static void on_percent(FmFileOpsJob* job, guint percent, FmProgressDisplay* data
         g_snprintf(percent_text, 64, "%d %%", percent);
         gtk_progress_bar_set_fraction(data->progress, (gdouble)percent/100);
         gtk_progress_bar_set_text(data->progress, percent_text);
+    }
+}
 
-        gdouble elapsed = g_timer_elapsed(data->timer, NULL);
-        if(elapsed >= 0.5)
+static void on_rate(FmFileOpsJob* job, FmProgressDisplay* data)
+{
+    goffset rate;
+    gint remaining;
+    char time_str[32];
+    char size_str[64];
+    char* text;
+    guint secs, mins = 0, hrs = 0;
+
+    if(!data->dlg || !data->remaining_time)
+        return;
+    fm_file_ops_job_get_rate(job, &rate, NULL, &remaining);
+    if(remaining < 0) /* not known yet */
+        return;
+    secs = (guint)remaining;
+    if(secs > 60)
+    {
+        mins = secs / 60;
+        secs %= 60;
+        if(mins > 60)
         {
-            gdouble remaining = elapsed * (100 - percent) / percent;
-            if(data->remaining_time)
-            {
-                char time_str[32];
-                guint secs = (guint)remaining;
-                guint mins = 0;
-                guint hrs = 0;
-                if(secs > 60)
-                {
-                    mins = secs / 60;
-                    secs %= 60;
-                    if(mins > 60)
-                    {
-                        hrs = mins / 60;
-                        mins %= 60;
-                    }
-                }
-                g_snprintf(time_str, 32, "%02d:%02d:%02d", hrs, mins, secs);
-                gtk_label_set_text(data->remaining_time, time_str);
-            }
+            hrs = mins / 60;
+            mins %= 60;
         }
     }
+    g_snprintf(time_str, 32, "%02d:%02d:%02d", hrs, mins, secs);
+    /* rate is in bytes only for copying and moving */
+    if((job->type == FM_FILE_OP_COPY || job->type == FM_FILE_OP_MOVE) && rate > 0)
+    {
+        fm_file_size_to_str(size_str, sizeof(size_str), rate, fm_config->si_unit);
+        /* Translators: first %s is remaining time, second is transfer speed */
+        text = g_strdup_printf(_("%s (%s/s)"), time_str, size_str);
+        gtk_label_set_text(data->remaining_time, text);
+        g_free(text);
+    }
+    else
+        gtk_label_set_text(data->remaining_time, time_str);
 }
 
 static void on_cur_file(FmFileOpsJob* job, const char* cur_file, FmProgressDisplay* data)
@@ -609,6 +625,7 @@ FmProgressDisplay* fm_file_ops_job_run_with_progress(GtkWindow* parent, FmFileOp
     g_signal_connect(job, "prepared", G_CALLBACK(on_prepared), data);
     g_signal_connect(job, "cur-file", G_CALLBACK(on_cur_file), data);
     g_signal_connect(job, "percent", G_CALLBACK(on_percent), data);
+    g_signal_connect(job, "rate", G_CALLBACK(on_rate), data);
     g_signal_connect(job, "finished", G_CALLBACK(on_finished), data);
     g_signal_connect(job, "cancelled", G_CALLBACK(on_cancelled), data);
 
@@ -633,6 +650,7 @@ static void fm_progress_display_destroy(FmProgressDisplay* data)
     g_signal_handlers_disconnect_by_func(data->job, on_prepared, data);
     g_signal_handlers_disconnect_by_func(data->job, on_cur_file, data);
     g_signal_handlers_disconnect_by_func(data->job, on_percent, data);
+    g_signal_handlers_disconnect_by_func(data->job, on_rate, data);
     g_signal_handlers_disconnect_by_func(data->job, on_finished, data);
 
     g_object_unref(data->job);
@@ -76,6 +76,9 @@ struct _FmStandardView
     guint sel_changed_idle;
     gboolean sel_changed_pending;
 
+    /* for thumbnails prioritization on scrolling */
+    guint visible_range_idle;
+
     FmFileInfoList* cached_selected_files;
     FmPathList* cached_selected_file_paths;
 
@@ -124,6 +127,7 @@ static void on_single_click_changed(FmConfig* cfg, FmStandardView* fv);
 static void on_big_icon_size_changed(FmConfig* cfg, FmStandardView* fv);
 static void on_small_icon_size_changed(FmConfig* cfg, FmStandardView* fv);
 static void on_thumbnail_size_changed(FmConfig* cfg, FmStandardView* fv);
+static void on_adjustment_changed(GtkAdjustment* adj, FmStandardView* fv);
 
 static FmFolderViewColumnInfo* _sv_column_info_new(FmFolderModelCol col_id)
 {
@@ -193,6 +197,14 @@ static void fm_standard_view_init(FmStandardView *self)
     gtk_scrolled_window_set_hadjustment((GtkScrolledWindow*)self, NULL);
     gtk_scrolled_window_set_vadjustment((GtkScrolledWindow*)self, NULL);
     gtk_scrolled_window_set_policy((GtkScrolledWindow*)self, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    g_signal_connect(gtk_scrolled_window_get_hadjustment((GtkScrolledWindow*)self),
+                     "value-changed", G_CALLBACK(on_adjustment_changed), self);
+    g_signal_connect(gtk_scrolled_window_get_hadjustment((GtkScrolledWindow*)self),
+                     "changed", G_CALLBACK(on_adjustment_changed), self);
+    g_signal_connect(gtk_scrolled_window_get_vadjustment((GtkScrolledWindow*)self),
+                     "value-changed", G_CALLBACK(on_adjustment_changed), self);
+    g_signal_connect(gtk_scrolled_window_get_vadjustment((GtkScrolledWindow*)self),
+                     "changed", G_CALLBACK(on_adjustment_changed), self);
 
     /* config change notifications */
     g_signal_connect(fm_config, "changed::single_click", G_CALLBACK(on_single_click_changed), self);
@@ -354,6 +366,16 @@ static void fm_standard_view_dispose(GObject *object)
         self->sel_changed_idle = 0;
     }
 
+    g_signal_handlers_disconnect_by_func(gtk_scrolled_window_get_hadjustment((GtkScrolledWindow*)self),
+                                         on_adjustment_changed, self);
+    g_signal_handlers_disconnect_by_func(gtk_scrolled_window_get_vadjustment((GtkScrolledWindow*)self),
+                                         on_adjustment_changed, self);
+    if(self->visible_range_idle)
+    {
+        g_source_remove(self->visible_range_idle);
+        self->visible_range_idle = 0;
+    }
+
     if(self->icon_size_changed_handler)
     {
         g_signal_handler_disconnect(fm_config, self->icon_size_changed_handler);
@@ -1519,6 +1541,44 @@ static void on_sel_changed(GObject* obj, FmStandardView* fv)
         fv->sel_changed_pending = TRUE;
 }
 
+/* tells the model which rows are visible so their thumbnails are loaded first */
+static gboolean on_visible_range_idle(gpointer user_data)
+{
+    FmStandardView* fv = (FmStandardView*)user_data;
+    GtkTreePath *start_path = NULL, *end_path = NULL;
+    gboolean has_range = FALSE;
+
+    GDK_THREADS_ENTER();
+    /* check if fv is destroyed already */
+    if(g_source_is_destroyed(g_main_current_source()))
+        goto _end;
+    fv->visible_range_idle = 0;
+    if(!fv->model || !fv->view)
+        goto _end;
+    if(fv->mode == FM_FV_LIST_VIEW)
+        has_range = gtk_tree_view_get_visible_range(GTK_TREE_VIEW(fv->view),
+                                                    &start_path, &end_path);
+    else
+        has_range = exo_icon_view_get_visible_range(EXO_ICON_VIEW(fv->view),
+                                                    &start_path, &end_path);
+    if(has_range)
+    {
+        fm_folder_model_set_visible_range(fv->model, start_path, end_path);
+        gtk_tree_path_free(start_path);
+        gtk_tree_path_free(end_path);
+    }
+_end:
+    GDK_THREADS_LEAVE();
+    return FALSE;
+}
+
+static void on_adjustment_changed(GtkAdjustment* adj, FmStandardView* fv)
+{
+    if(!fv->visible_range_idle)
+        fv->visible_range_idle = g_timeout_add_full(G_PRIORITY_LOW, 100,
+                                                    on_visible_range_idle, fv, NULL);
+}
+
 static void fm_standard_view_select_invert(FmFolderView* ffv)
 {
     FmStandardView* fv = FM_STANDARD_VIEW(ffv);
@@ -139,6 +139,73 @@ static GObject* read_image_from_stream(GInputStream* stream, guint64 len, GCance
     return (GObject*)gdk_pixbuf_new_from_stream(stream, cancellable, NULL);
 }
 
+typedef struct
+{
+    int max_width;
+    int max_height;
+    int orig_width;
+    int orig_height;
+} SizeHint;
+
+static void on_size_prepared(GdkPixbufLoader* loader, int width, int height, SizeHint* hint)
+{
+    hint->orig_width = width;
+    hint->orig_height = height;
+    if(width <= hint->max_width && height <= hint->max_height)
+        return;
+    /* keep aspect ratio, the JPEG loader will decode it scaled already */
+    if((gint64)width * hint->max_height > (gint64)height * hint->max_width)
+    {
+        height = MAX(1, (gint64)height * hint->max_width / width);
+        width = hint->max_width;
+    }
+    else
+    {
+        width = MAX(1, (gint64)width * hint->max_height / height);
+        height = hint->max_height;
+    }
+    gdk_pixbuf_loader_set_size(loader, width, height);
+}
+
+static GObject* read_scaled_image_from_stream(GInputStream* stream, guint64 len,
+                                              int max_width, int max_height,
+                                              int* orig_width, int* orig_height,
+                                              GCancellable* cancellable)
+{
+    GdkPixbufLoader* loader = gdk_pixbuf_loader_new();
+    GdkPixbuf* pix = NULL;
+    SizeHint hint;
+    guchar buf[16384];
+    gssize n;
+    gboolean ok = TRUE;
+
+    hint.max_width = max_width;
+    hint.max_height = max_height;
+    hint.orig_width = hint.orig_height = 0;
+    g_signal_connect(loader, "size-prepared", G_CALLBACK(on_size_prepared), &hint);
+    while((n = g_input_stream_read(stream, buf, sizeof(buf), cancellable, NULL)) > 0)
+    {
+        if(!gdk_pixbuf_loader_write(loader, buf, n, NULL))
+        {
+            ok = FALSE;
+            break;
+        }
+    }
+    /* the loader should be closed even on error */
+    if(gdk_pixbuf_loader_close(loader, NULL) && ok && n == 0)
+    {
+        pix = gdk_pixbuf_loader_get_pixbuf(loader);
+        if(pix)
+        {
+            g_object_ref(pix);
+            *orig_width = hint.orig_width;
+            *orig_height = hint.orig_height;
+        }
+    }
+    g_object_unref(loader);
+    return (GObject*)pix;
+}
+
 static gboolean write_image(GObject* image, const char* filename, const char* uri, const char* mtime)
 {
     return gdk_pixbuf_save(GDK_PIXBUF(image), filename, "png", NULL,
@@ -179,7 +246,8 @@ static FmThumbnailLoaderBackend gtk_backend = {
     rotate_image,
     get_image_width,
     get_image_height,
-    get_image_text
+    get_image_text,
+    read_scaled_image_from_stream
 };
 
 /* in main loop */
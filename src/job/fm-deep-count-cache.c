@@ -0,0 +1,214 @@
+/*
+ *      fm-deep-count-cache.c
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* The cache is a text file $XDG_CACHE_HOME/libfm/dirsizes, each line is
+ * a record for one folder:
+ *     <mtime> <ctime> <count> <size> <ondisk size> <path>
+ * Totals include only entries of the folder which aren't folders, so the
+ * record stays valid until the folder itself is changed, subfolders are
+ * checked by their own records. Changes of file content which don't touch
+ * the folder are not detected. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fm-deep-count-cache.h"
+#include <string.h>
+#include <glib/gstdio.h>
+
+/* records not used since start are dropped above this number */
+#define CACHE_MAX_RECORDS 100000
+
+typedef struct
+{
+    guint64 mtime;
+    guint64 ctime;
+    FmDeepCountCacheRecord totals;
+    gboolean used;
+} CacheEntry;
+
+static GHashTable* cache = NULL; /* path -> CacheEntry */
+static gboolean dirty = FALSE;
+
+/* the cache is shared by all jobs and their workers */
+G_LOCK_DEFINE_STATIC(cache);
+
+static void cache_entry_free(gpointer data)
+{
+    g_slice_free(CacheEntry, data);
+}
+
+static char* cache_get_file(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "libfm", "dirsizes", NULL);
+}
+
+static void cache_load(void)
+{
+    char *file, *contents, *line, *next, *p;
+    CacheEntry* ent;
+
+    cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  cache_entry_free);
+    file = cache_get_file();
+    if(!g_file_get_contents(file, &contents, NULL, NULL))
+    {
+        g_free(file);
+        return;
+    }
+    g_free(file);
+    for(line = contents; line && *line; line = next)
+    {
+        next = strchr(line, '\n');
+        if(!next) /* incomplete record */
+            break;
+        *next++ = '\0';
+        ent = g_slice_new(CacheEntry);
+        ent->mtime = g_ascii_strtoull(line, &p, 10);
+        ent->ctime = g_ascii_strtoull(p, &p, 10);
+        ent->totals.count = (guint)g_ascii_strtoull(p, &p, 10);
+        ent->totals.size = g_ascii_strtoll(p, &p, 10);
+        ent->totals.ondisk_size = g_ascii_strtoll(p, &p, 10);
+        ent->used = FALSE;
+        if(*p != ' ' || p[1] != '/')
+        {
+            cache_entry_free(ent);
+            continue;
+        }
+        g_hash_table_replace(cache, g_strdup(p + 1), ent);
+    }
+    g_free(contents);
+}
+
+/*
+ * _fm_deep_count_cache_lookup
+ * @path: path of the folder
+ * @st: current status of the folder
+ * @rec: (out): location to store totals
+ *
+ * Retrieves totals of the folder at @path counted before if the folder
+ * was not changed since then.
+ *
+ * Returns: %TRUE if valid record was found.
+ */
+gboolean _fm_deep_count_cache_lookup(const char* path, const struct stat* st,
+                                     FmDeepCountCacheRecord* rec)
+{
+    CacheEntry* ent;
+    gboolean ret = FALSE;
+
+    G_LOCK(cache);
+    if(G_UNLIKELY(!cache))
+        cache_load();
+    ent = (CacheEntry*)g_hash_table_lookup(cache, path);
+    if(ent && ent->mtime == (guint64)st->st_mtime && ent->ctime == (guint64)st->st_ctime)
+    {
+        *rec = ent->totals;
+        ent->used = TRUE;
+        ret = TRUE;
+    }
+    G_UNLOCK(cache);
+    return ret;
+}
+
+/*
+ * _fm_deep_count_cache_store
+ * @path: path of the folder
+ * @st: status of the folder before it was read
+ * @started: time when reading of the folder was started
+ * @rec: counted totals
+ *
+ * Remembers totals of the folder at @path. The record is not stored if
+ * the folder was changed in the same second when it was read since the
+ * next change in that second would not be noticed.
+ */
+void _fm_deep_count_cache_store(const char* path, const struct stat* st,
+                                time_t started, const FmDeepCountCacheRecord* rec)
+{
+    CacheEntry* ent;
+
+    if(st->st_mtime >= started || st->st_ctime >= started ||
+       strchr(path, '\n') != NULL)
+        return;
+    G_LOCK(cache);
+    if(G_UNLIKELY(!cache))
+        cache_load();
+    ent = (CacheEntry*)g_hash_table_lookup(cache, path);
+    if(!ent)
+    {
+        ent = g_slice_new(CacheEntry);
+        g_hash_table_insert(cache, g_strdup(path), ent);
+    }
+    ent->mtime = st->st_mtime;
+    ent->ctime = st->st_ctime;
+    ent->totals = *rec;
+    ent->used = TRUE;
+    dirty = TRUE;
+    G_UNLOCK(cache);
+}
+
+/*
+ * _fm_deep_count_cache_save
+ *
+ * Writes the cache to the disk if it was changed.
+ */
+void _fm_deep_count_cache_save(void)
+{
+    GString* str;
+    GHashTableIter it;
+    gpointer key, value;
+    gboolean prune;
+    char *file, *dir;
+
+    G_LOCK(cache);
+    if(!dirty)
+    {
+        G_UNLOCK(cache);
+        return;
+    }
+    dirty = FALSE;
+    prune = (g_hash_table_size(cache) > CACHE_MAX_RECORDS);
+    str = g_string_sized_new(g_hash_table_size(cache) * 64);
+    g_hash_table_iter_init(&it, cache);
+    while(g_hash_table_iter_next(&it, &key, &value))
+    {
+        CacheEntry* ent = (CacheEntry*)value;
+        if(prune && !ent->used)
+        {
+            g_hash_table_iter_remove(&it);
+            continue;
+        }
+        g_string_append_printf(str, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                               " %u %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %s\n",
+                               ent->mtime, ent->ctime, ent->totals.count,
+                               (gint64)ent->totals.size,
+                               (gint64)ent->totals.ondisk_size, (char*)key);
+    }
+    G_UNLOCK(cache);
+    file = cache_get_file();
+    dir = g_path_get_dirname(file);
+    if(g_mkdir_with_parents(dir, 0700) == 0)
+        g_file_set_contents(file, str->str, str->len, NULL);
+    g_free(dir);
+    g_free(file);
+    g_string_free(str, TRUE);
+}
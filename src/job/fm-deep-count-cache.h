@@ -0,0 +1,47 @@
+/*
+ *      fm-deep-count-cache.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_DEEP_COUNT_CACHE_H__
+#define __FM_DEEP_COUNT_CACHE_H__
+
+#include <glib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+G_BEGIN_DECLS
+
+/* totals of the folder's own entries which aren't folders */
+typedef struct
+{
+    guint count;
+    goffset size;
+    goffset ondisk_size;
+} FmDeepCountCacheRecord;
+
+gboolean _fm_deep_count_cache_lookup(const char* path, const struct stat* st,
+                                     FmDeepCountCacheRecord* rec);
+void _fm_deep_count_cache_store(const char* path, const struct stat* st,
+                                time_t started, const FmDeepCountCacheRecord* rec);
+void _fm_deep_count_cache_save(void);
+
+G_END_DECLS
+
+#endif /* __FM_DEEP_COUNT_CACHE_H__ */
@@ -0,0 +1,37 @@
+/*
+ *      fm-deep-count-job-private.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_DEEP_COUNT_JOB_PRIVATE_H__
+#define __FM_DEEP_COUNT_JOB_PRIVATE_H__
+
+#include <glib.h>
+#include "fm-deep-count-job.h"
+
+G_BEGIN_DECLS
+
+/* totals are changed by the counting threads so only this should read them
+   while the job runs */
+void _fm_deep_count_job_get_totals(FmDeepCountJob* dc, guint* count,
+                                   goffset* total_size, goffset* total_ondisk_size);
+
+G_END_DECLS
+
+#endif
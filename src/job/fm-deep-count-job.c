@@ -31,18 +31,84 @@
  * size of all given files and directories, and size on disk for them.
  * If flags for the job include FM_DC_JOB_PREPARE_MOVE then also count of
  * files to move between volumes will be counted as well.
+ *
+ * If flags for the job include FM_DC_JOB_USE_CACHE then totals of files in
+ * local folders are remembered and reused by next counts until the folder
+ * is changed, so only changed folders are read again. Changes of contents
+ * of files are not noticed that way so the flag is intended for display
+ * purposes only.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "fm-deep-count-job.h"
+#include "fm-deep-count-job-private.h"
+#include "fm-deep-count-cache.h"
 #include <glib/gstdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef HAVE_FDOPENDIR
+# define HAVE_PARALLEL_COUNT 1
+#endif
+
+/* max number of threads counting subtrees concurrently */
+#define DC_MAX_WORKERS 8
+/* number of counted entries after which totals are added to the job */
+#define DC_MERGE_BATCH 256
+/* how often running totals are sampled by the main thread, in milliseconds */
+#define DC_PROGRESS_INTERVAL 250
+
+typedef struct
+{
+    guint count;
+    goffset total_size;
+    goffset total_ondisk_size;
+} FmDeepCountTotals;
+
+/* running totals of the job, kept in _reserved1 */
+typedef struct
+{
+    FmDeepCountTotals* items; /* totals of finished top level items */
+    guint n_items; /* number of top level items started */
+    gboolean in_item; /* the last started item is being counted */
+    FmDeepCountTotals base; /* job totals before the last started item */
+    FmDeepCountTotals sampled; /* job totals when progress was emitted */
+    volatile gint sampling; /* main thread samples the job */
+} FmDeepCountProgress;
+
+enum
+{
+    PROGRESS,
+    N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+/* job totals are updated by many workers at once and read by main thread */
+G_LOCK_DEFINE_STATIC(totals);
 
 static void fm_deep_count_job_dispose              (GObject *object);
+static void fm_deep_count_job_finalize             (GObject *object);
 G_DEFINE_TYPE(FmDeepCountJob, fm_deep_count_job, FM_TYPE_JOB);
 
 static gboolean fm_deep_count_job_run(FmJob* job);
+static gboolean fm_deep_count_job_run_async(FmJob* job);
+
+#ifdef HAVE_PARALLEL_COUNT
+typedef struct _FmDeepCountEngine FmDeepCountEngine;
 
+static gboolean deep_count_native(FmDeepCountEngine* engine, const char* path);
+static FmDeepCountEngine* deep_count_engine_new(FmDeepCountJob* job);
+static void deep_count_engine_free(FmDeepCountEngine* engine);
+#else
 static gboolean deep_count_posix(FmDeepCountJob* job, const char* path);
+#endif
 static gboolean deep_count_gio(FmDeepCountJob* job, GFileInfo* inf, GFile* gf);
 
 static const char query_str[] =
@@ -59,10 +125,31 @@ static void fm_deep_count_job_class_init(FmDeepCountJobClass *klass)
     FmJobClass* job_class;
     g_object_class = G_OBJECT_CLASS(klass);
     g_object_class->dispose = fm_deep_count_job_dispose;
-    /* use finalize from parent class */
+    g_object_class->finalize = fm_deep_count_job_finalize;
 
     job_class = FM_JOB_CLASS(klass);
     job_class->run = fm_deep_count_job_run;
+    job_class->run_async = fm_deep_count_job_run_async;
+
+    /**
+     * FmDeepCountJob::progress:
+     * @job: a job object which emitted the signal
+     *
+     * The #FmDeepCountJob::progress signal is emitted a few times a second
+     * while @job runs asynchronously and its totals are changed. Handler
+     * can read running totals from @job and use
+     * fm_deep_count_job_get_item_totals() to get totals of each item.
+     *
+     * Since: 1.2.0
+     */
+    signals[PROGRESS] =
+        g_signal_new( "progress",
+                      G_TYPE_FROM_CLASS ( klass ),
+                      G_SIGNAL_RUN_FIRST,
+                      G_STRUCT_OFFSET ( FmDeepCountJobClass, progress ),
+                      NULL, NULL,
+                      g_cclosure_marshal_VOID__VOID,
+                      G_TYPE_NONE, 0 );
 }
 
 
@@ -83,10 +170,20 @@ static void fm_deep_count_job_dispose(GObject *object)
     G_OBJECT_CLASS(fm_deep_count_job_parent_class)->dispose(object);
 }
 
+static void fm_deep_count_job_finalize(GObject *object)
+{
+    FmDeepCountProgress* prog = (FmDeepCountProgress*)FM_DEEP_COUNT_JOB(object)->_reserved1;
+
+    g_free(prog->items);
+    g_slice_free(FmDeepCountProgress, prog);
+    G_OBJECT_CLASS(fm_deep_count_job_parent_class)->finalize(object);
+}
+
 
 static void fm_deep_count_job_init(FmDeepCountJob *self)
 {
     fm_job_init_cancellable(FM_JOB(self));
+    self->_reserved1 = g_slice_new0(FmDeepCountProgress);
 }
 
 /**
@@ -108,19 +205,115 @@ FmDeepCountJob *fm_deep_count_job_new(FmPathList* paths, FmDeepCountJobFlags fla
     return job;
 }
 
+static inline void get_totals(FmDeepCountJob* dc, FmDeepCountTotals* t)
+{
+    t->count = dc->count;
+    t->total_size = dc->total_size;
+    t->total_ondisk_size = dc->total_ondisk_size;
+}
+
+/* emits progress if totals were changed since the last time */
+static void sample_progress(FmDeepCountJob* dc)
+{
+    FmDeepCountProgress* prog = (FmDeepCountProgress*)dc->_reserved1;
+    gboolean changed;
+
+    G_LOCK(totals);
+    changed = (prog->sampled.count != dc->count ||
+               prog->sampled.total_size != dc->total_size ||
+               prog->sampled.total_ondisk_size != dc->total_ondisk_size);
+    get_totals(dc, &prog->sampled);
+    G_UNLOCK(totals);
+    if(changed)
+        g_signal_emit(dc, signals[PROGRESS], 0);
+}
+
+static gpointer sample_progress_in_main_thread(FmJob* job, gpointer unused)
+{
+    sample_progress(FM_DEEP_COUNT_JOB(job));
+    return NULL;
+}
+
+static gboolean on_sample_progress(gpointer user_data)
+{
+    FmDeepCountJob* dc = FM_DEEP_COUNT_JOB(user_data);
+
+    if(!fm_job_is_cancelled(FM_JOB(dc)))
+        sample_progress(dc);
+    if(fm_job_is_running(FM_JOB(dc)))
+        return TRUE;
+    g_atomic_int_set(&((FmDeepCountProgress*)dc->_reserved1)->sampling, 0);
+    return FALSE;
+}
+
+static gboolean fm_deep_count_job_run_async(FmJob* job)
+{
+    FmDeepCountProgress* prog = (FmDeepCountProgress*)FM_DEEP_COUNT_JOB(job)->_reserved1;
+    guint id;
+
+    /* the main thread takes totals from the job at the fixed rate so
+       the counting threads never wait for it */
+    g_atomic_int_set(&prog->sampling, 1);
+    id = g_timeout_add_full(G_PRIORITY_DEFAULT, DC_PROGRESS_INTERVAL,
+                            on_sample_progress, g_object_ref(job),
+                            g_object_unref);
+    if(FM_JOB_CLASS(fm_deep_count_job_parent_class)->run_async(job))
+        return TRUE;
+    g_source_remove(id);
+    g_atomic_int_set(&prog->sampling, 0);
+    return FALSE;
+}
+
+static void start_item(FmDeepCountJob* dc, FmDeepCountProgress* prog)
+{
+    G_LOCK(totals);
+    get_totals(dc, &prog->base);
+    prog->n_items++;
+    prog->in_item = TRUE;
+    G_UNLOCK(totals);
+}
+
+static void finish_item(FmDeepCountJob* dc, FmDeepCountProgress* prog)
+{
+    FmDeepCountTotals* t = &prog->items[prog->n_items - 1];
+
+    G_LOCK(totals);
+    t->count = dc->count - prog->base.count;
+    t->total_size = dc->total_size - prog->base.total_size;
+    t->total_ondisk_size = dc->total_ondisk_size - prog->base.total_ondisk_size;
+    prog->in_item = FALSE;
+    G_UNLOCK(totals);
+}
+
 static gboolean fm_deep_count_job_run(FmJob* job)
 {
     FmDeepCountJob* dc = (FmDeepCountJob*)job;
+    FmDeepCountProgress* prog = (FmDeepCountProgress*)dc->_reserved1;
     GList* l;
-
+#ifdef HAVE_PARALLEL_COUNT
+    FmDeepCountEngine* engine = NULL;
+#endif
+
+    G_LOCK(totals);
+    g_free(prog->items);
+    prog->items = g_new0(FmDeepCountTotals, fm_path_list_get_length(dc->paths));
+    prog->n_items = 0;
+    G_UNLOCK(totals);
     l = fm_path_list_peek_head_link(dc->paths);
     for(; !fm_job_is_cancelled(job) && l; l=l->next)
     {
         FmPath* path = FM_PATH(l->data);
+        start_item(dc, prog);
         if(fm_path_is_native(path)) /* if it's a native file, use posix APIs */
         {
             char *path_str = fm_path_to_str(path);
+#ifdef HAVE_PARALLEL_COUNT
+            if(!engine)
+                engine = deep_count_engine_new(dc);
+            deep_count_native(engine, path_str);
+#else
             deep_count_posix( dc, path_str );
+#endif
             g_free(path_str);
         }
         else
@@ -129,10 +322,292 @@ static gboolean fm_deep_count_job_run(FmJob* job)
             deep_count_gio( dc, NULL, gf );
             g_object_unref(gf);
         }
+        finish_item(dc, prog);
     }
+#ifdef HAVE_PARALLEL_COUNT
+    if(engine)
+        deep_count_engine_free(engine);
+    if(dc->flags & FM_DC_JOB_USE_CACHE)
+        _fm_deep_count_cache_save();
+#endif
+    /* show the final totals before the job is finished */
+    if(g_atomic_int_get(&prog->sampling) && !fm_job_is_cancelled(job))
+        fm_job_call_main_thread(job, sample_progress_in_main_thread, NULL);
     return TRUE;
 }
 
+/* adds totals counted by a thread to the job, totals of the job are read
+   by other threads so they should never be changed directly */
+static void merge_totals(FmDeepCountJob* job, FmDeepCountTotals* t)
+{
+    if(t->count == 0)
+        return;
+    G_LOCK(totals);
+    job->count += t->count;
+    job->total_size += t->total_size;
+    job->total_ondisk_size += t->total_ondisk_size;
+    G_UNLOCK(totals);
+    t->count = 0;
+    t->total_size = t->total_ondisk_size = 0;
+}
+
+#ifdef HAVE_PARALLEL_COUNT
+/* subfolders are given to idle threads of the pool as soon as they are
+   found, each thread keeps own totals and adds them to the job in batches */
+struct _FmDeepCountEngine
+{
+    FmDeepCountJob* job;
+    GThreadPool* pool; /* NULL if the tree is counted sequentially */
+    guint n_workers;
+    volatile gint pending; /* number of unfinished subtrees */
+    GAsyncQueue* done; /* receives notification when pending drops to 0 */
+};
+
+/* only one error should be shown at a time */
+G_LOCK_DEFINE_STATIC(error);
+
+/* stats entry name in folder dfd */
+static gboolean stat_entry(FmDeepCountJob* job, int dfd, const char* name,
+                           struct stat* st)
+{
+    int flags = (job->flags & FM_DC_JOB_FOLLOW_LINKS) ? 0 : AT_SYMLINK_NOFOLLOW;
+
+    while(fstatat(dfd, name, st, flags) < 0)
+    {
+        int errsv = errno;
+        GError* err;
+        FmJobErrorAction act;
+
+        if(fm_job_is_cancelled(FM_JOB(job)))
+            return FALSE;
+        err = g_error_new(G_IO_ERROR, g_io_error_from_errno(errsv), "%s", g_strerror(errsv));
+        G_LOCK(error);
+        act = fm_job_emit_error(FM_JOB(job), err, FM_JOB_ERROR_MILD);
+        G_UNLOCK(error);
+        g_error_free(err);
+        if(act != FM_JOB_RETRY)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static void add_entry(FmDeepCountJob* job, FmDeepCountTotals* t, struct stat* st,
+                      gboolean is_child)
+{
+    ++t->count;
+    t->total_size += (goffset)st->st_size;
+    t->total_ondisk_size += (st->st_blocks * 512);
+    /* for moving across different devices, an additional 'delete'
+     * for source file is needed. so let's +1 for the delete.*/
+    if(is_child && (job->flags & FM_DC_JOB_PREPARE_MOVE))
+    {
+        ++t->total_size;
+        ++t->total_ondisk_size;
+        ++t->count;
+    }
+}
+
+static inline gboolean may_be_dir(struct dirent* de)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    return (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN);
+#else
+    return TRUE;
+#endif
+}
+
+static gboolean should_descend(FmDeepCountJob* job, struct stat* st)
+{
+    if(!S_ISDIR(st->st_mode))
+        return FALSE;
+    /* NOTE: if job->dest_dev is 0, that means our destination
+     * folder is not on native UNIX filesystem. Hence it's not
+     * on the same device. Our st.st_dev will always be non-zero
+     * since our file is on a native UNIX filesystem. */
+
+    /* only descends into files on the same filesystem */
+    if(job->flags & FM_DC_JOB_SAME_FS)
+        return (st->st_dev == job->dest_dev);
+    /* only descends into files on the different filesystem */
+    if(job->flags & FM_DC_JOB_PREPARE_MOVE)
+        return (st->st_dev != job->dest_dev);
+    return TRUE;
+}
+
+static inline int open_dir(FmDeepCountJob* job, int dfd, const char* name)
+{
+    int flags = O_RDONLY | O_DIRECTORY;
+
+    if(!(job->flags & FM_DC_JOB_FOLLOW_LINKS))
+        flags |= O_NOFOLLOW;
+    return openat(dfd, name, flags);
+}
+
+/* counts content of folder opened as dfd (which is closed then) */
+static void count_dir(FmDeepCountEngine* engine, int dfd, const char* path,
+                      FmDeepCountTotals* t)
+{
+    FmDeepCountJob* job = engine->job;
+    DIR* dir;
+    struct dirent* de;
+    struct stat st, dir_st;
+    FmDeepCountCacheRecord own = {0, 0, 0};
+    gboolean use_cache, cached = FALSE, complete = TRUE;
+    time_t started = 0;
+
+    /* cached totals of files are valid while the folder isn't changed,
+       following symlinks isn't supported since it's another tree */
+    use_cache = ((job->flags & FM_DC_JOB_USE_CACHE) &&
+                 !(job->flags & FM_DC_JOB_FOLLOW_LINKS) && fstat(dfd, &dir_st) == 0);
+    if(use_cache)
+    {
+        started = time(NULL);
+        cached = _fm_deep_count_cache_lookup(path, &dir_st, &own);
+    }
+    dir = fdopendir(dfd);
+    if(!dir)
+    {
+        close(dfd);
+        return;
+    }
+    while(!fm_job_is_cancelled(FM_JOB(job)) && (de = readdir(dir)) != NULL)
+    {
+        const char* name = de->d_name;
+        char* sub;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        /* only subfolders should be checked in unchanged folder */
+        if(cached && !may_be_dir(de))
+            continue;
+        if(!stat_entry(job, dirfd(dir), name, &st))
+        {
+            complete = FALSE;
+            continue;
+        }
+        if(!S_ISDIR(st.st_mode))
+        {
+            if(cached)
+                continue;
+            ++own.count;
+            own.size += (goffset)st.st_size;
+            own.ondisk_size += (st.st_blocks * 512);
+        }
+        add_entry(job, t, &st, TRUE);
+        if(should_descend(job, &st))
+        {
+            sub = g_build_filename(path, name, NULL);
+            /* split the work only while there are idle workers */
+            if(engine->pool &&
+               g_thread_pool_unprocessed(engine->pool) < engine->n_workers)
+            {
+                g_atomic_int_inc(&engine->pending);
+                g_thread_pool_push(engine->pool, sub, NULL);
+            }
+            else
+            {
+                int sub_fd = open_dir(job, dirfd(dir), name);
+                if(sub_fd >= 0)
+                    count_dir(engine, sub_fd, sub, t);
+                g_free(sub);
+            }
+        }
+        if(t->count >= DC_MERGE_BATCH)
+            merge_totals(job, t);
+    }
+    closedir(dir);
+    if(cached)
+    {
+        t->count += own.count;
+        t->total_size += own.size;
+        t->total_ondisk_size += own.ondisk_size;
+        if(job->flags & FM_DC_JOB_PREPARE_MOVE)
+        {
+            t->count += own.count;
+            t->total_size += own.count;
+            t->total_ondisk_size += own.count;
+        }
+    }
+    else if(use_cache && complete && !fm_job_is_cancelled(FM_JOB(job)))
+        _fm_deep_count_cache_store(path, &dir_st, started, &own);
+}
+
+/* this is called from a thread of the pool */
+static void count_task_run(gpointer data, gpointer user_data)
+{
+    char* path = (char*)data;
+    FmDeepCountEngine* engine = (FmDeepCountEngine*)user_data;
+    FmDeepCountTotals t = {0, 0, 0};
+    int fd;
+
+    if(!fm_job_is_cancelled(FM_JOB(engine->job)))
+    {
+        fd = open_dir(engine->job, AT_FDCWD, path);
+        if(fd >= 0)
+            count_dir(engine, fd, path, &t);
+    }
+    merge_totals(engine->job, &t);
+    g_free(path);
+    if(g_atomic_int_dec_and_test(&engine->pending))
+        g_async_queue_push(engine->done, GINT_TO_POINTER(1));
+}
+
+static FmDeepCountEngine* deep_count_engine_new(FmDeepCountJob* job)
+{
+    FmDeepCountEngine* engine = g_slice_new(FmDeepCountEngine);
+
+    engine->job = job;
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    engine->n_workers = CLAMP(g_get_num_processors(), 2, DC_MAX_WORKERS);
+#else
+    engine->n_workers = 4;
+#endif
+    /* workers report errors via main thread so if it's waiting for us
+       then the tree should be counted by this thread only */
+    if(g_main_context_is_owner(g_main_context_default()))
+        engine->pool = NULL;
+    else
+        engine->pool = g_thread_pool_new(count_task_run, engine,
+                                         engine->n_workers, FALSE, NULL);
+    engine->done = g_async_queue_new();
+    return engine;
+}
+
+static void deep_count_engine_free(FmDeepCountEngine* engine)
+{
+    if(engine->pool)
+        g_thread_pool_free(engine->pool, FALSE, TRUE);
+    g_async_queue_unref(engine->done);
+    g_slice_free(FmDeepCountEngine, engine);
+}
+
+static gboolean deep_count_native(FmDeepCountEngine* engine, const char* path)
+{
+    FmDeepCountJob* job = engine->job;
+    FmDeepCountTotals t = {0, 0, 0};
+    struct stat st;
+    int fd;
+
+    if(!stat_entry(job, AT_FDCWD, path, &st))
+        return FALSE;
+    add_entry(job, &t, &st, FALSE);
+    if(!fm_job_is_cancelled(FM_JOB(job)) && should_descend(job, &st) &&
+       (fd = open_dir(job, AT_FDCWD, path)) >= 0)
+    {
+        /* the top level folder is handled by the job thread itself */
+        engine->pending = 1;
+        count_dir(engine, fd, path, &t);
+        merge_totals(job, &t);
+        /* wait till all subtrees are counted */
+        if(!g_atomic_int_dec_and_test(&engine->pending))
+            g_async_queue_pop(engine->done);
+    }
+    else
+        merge_totals(job, &t);
+    return TRUE;
+}
+#else /* !HAVE_PARALLEL_COUNT */
+
 static gboolean deep_count_posix(FmDeepCountJob* job, const char *path)
 {
     FmJob* fmjob = FM_JOB(job);
@@ -147,9 +622,8 @@ _retry_stat:
 
     if( ret == 0 )
     {
-        ++job->count;
-        job->total_size += (goffset)st.st_size;
-        job->total_ondisk_size += (st.st_blocks * 512);
+        FmDeepCountTotals t = {1, (goffset)st.st_size, (goffset)st.st_blocks * 512};
+        merge_totals(job, &t);
 
         /* NOTE: if job->dest_dev is 0, that means our destination
          * folder is not on native UNIX filesystem. Hence it's not
@@ -200,9 +674,8 @@ _retry_stat:
                          * for source file is needed. so let's +1 for the delete.*/
                         if(job->flags & FM_DC_JOB_PREPARE_MOVE)
                         {
-                            ++job->total_size;
-                            ++job->total_ondisk_size;
-                            ++job->count;
+                            FmDeepCountTotals t = {1, 1, 1};
+                            merge_totals(job, &t);
                         }
                     }
                 }
@@ -214,10 +687,13 @@ _retry_stat:
     return TRUE;
 }
 
+#endif /* HAVE_PARALLEL_COUNT */
+
 static gboolean deep_count_gio(FmDeepCountJob* job, GFileInfo* inf, GFile* gf)
 {
     FmJob* fmjob = FM_JOB(job);
     GError* err = NULL;
+    FmDeepCountTotals t;
     GFileType type;
     const char* fs_id;
     gboolean descend;
@@ -249,9 +725,9 @@ _retry_query_info:
     type = g_file_info_get_file_type(inf);
     descend = TRUE;
 
-    ++job->count;
-    job->total_size += g_file_info_get_size(inf);
-    job->total_ondisk_size += g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+    t.count = 1;
+    t.total_size = g_file_info_get_size(inf);
+    t.total_ondisk_size = g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
 
     /* prepare for moving across different devices */
     if( job->flags & FM_DC_JOB_PREPARE_MOVE )
@@ -260,13 +736,14 @@ _retry_query_info:
         if( g_strcmp0(fs_id, job->dest_fs_id) != 0 )
         {
             /* files on different device requires an additional 'delete' for the source file. */
-            ++job->total_size; /* this is for the additional delete */
-            ++job->total_ondisk_size;
-            ++job->count;
+            ++t.total_size; /* this is for the additional delete */
+            ++t.total_ondisk_size;
+            ++t.count;
         }
         else
             descend = FALSE;
     }
+    merge_totals(job, &t);
 
     if( type == G_FILE_TYPE_DIRECTORY )
     {
@@ -363,3 +840,79 @@ void fm_deep_count_job_set_dest(FmDeepCountJob* dc, dev_t dev, const char* fs_id
     if(fs_id)
         dc->dest_fs_id = g_intern_string(fs_id);
 }
+
+/**
+ * fm_deep_count_job_get_item_totals
+ * @dc: a job to inspect
+ * @n: index of item in the list of paths given to the job
+ * @count: (out) (allow-none): location to store number of files
+ * @total_size: (out) (allow-none): location to store total size
+ * @total_ondisk_size: (out) (allow-none): location to store size on disk
+ *
+ * Retrieves totals of the @n-th item of the job @dc. If the item is being
+ * counted at the moment then totals counted so far are returned. This
+ * may be used from handler of #FmDeepCountJob::progress signal.
+ *
+ * Returns: %FALSE if counting of the item is not started yet.
+ *
+ * Since: 1.2.0
+ */
+gboolean fm_deep_count_job_get_item_totals(FmDeepCountJob* dc, guint n,
+                                           guint* count, goffset* total_size,
+                                           goffset* total_ondisk_size)
+{
+    FmDeepCountProgress* prog;
+    FmDeepCountTotals t;
+
+    g_return_val_if_fail(FM_IS_DEEP_COUNT_JOB(dc), FALSE);
+    prog = (FmDeepCountProgress*)dc->_reserved1;
+    G_LOCK(totals);
+    if(n >= prog->n_items)
+    {
+        G_UNLOCK(totals);
+        return FALSE;
+    }
+    if(n + 1 == prog->n_items && prog->in_item)
+    {
+        t.count = dc->count - prog->base.count;
+        t.total_size = dc->total_size - prog->base.total_size;
+        t.total_ondisk_size = dc->total_ondisk_size - prog->base.total_ondisk_size;
+    }
+    else
+        t = prog->items[n];
+    G_UNLOCK(totals);
+    if(count)
+        *count = t.count;
+    if(total_size)
+        *total_size = t.total_size;
+    if(total_ondisk_size)
+        *total_ondisk_size = t.total_ondisk_size;
+    return TRUE;
+}
+
+/*
+ * _fm_deep_count_job_get_totals
+ * @dc: a job to inspect
+ * @count: (out) (allow-none): location to store number of files
+ * @total_size: (out) (allow-none): location to store total size
+ * @total_ondisk_size: (out) (allow-none): location to store size on disk
+ *
+ * Retrieves totals of the job @dc counted so far. Totals are changed by
+ * the counting threads so they should be read only with this function
+ * while @dc is running. This function may be called from any thread.
+ */
+void _fm_deep_count_job_get_totals(FmDeepCountJob* dc, guint* count,
+                                   goffset* total_size, goffset* total_ondisk_size)
+{
+    FmDeepCountTotals t;
+
+    G_LOCK(totals);
+    get_totals(dc, &t);
+    G_UNLOCK(totals);
+    if(count)
+        *count = t.count;
+    if(total_size)
+        *total_size = t.total_size;
+    if(total_ondisk_size)
+        *total_ondisk_size = t.total_ondisk_size;
+}
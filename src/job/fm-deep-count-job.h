@@ -50,13 +50,15 @@ typedef struct _FmDeepCountJobClass        FmDeepCountJobClass;
  * @FM_DC_JOB_SAME_FS: only do deep count for files on the same devices. what's the use case of this?
  * @FM_DC_JOB_PREPARE_MOVE: special handling for moving files. only do deep count for files on different devices
  * @FM_DC_JOB_PREPARE_DELETE: special handling for deleting files
+ * @FM_DC_JOB_USE_CACHE: (since 1.2.0) reuse totals of unchanged local folders counted before
  */
 typedef enum {
     FM_DC_JOB_DEFAULT = 0,
     FM_DC_JOB_FOLLOW_LINKS = 1<<0,
     FM_DC_JOB_SAME_FS = 1<<1,
     FM_DC_JOB_PREPARE_MOVE = 1<<2,
-    FM_DC_JOB_PREPARE_DELETE = 1 <<3
+    FM_DC_JOB_PREPARE_DELETE = 1 <<3,
+    FM_DC_JOB_USE_CACHE = 1 << 4
 } FmDeepCountJobFlags;
 
 /**
@@ -86,10 +88,17 @@ struct _FmDeepCountJob
     const char* dest_fs_id;
 };
 
+/**
+ * FmDeepCountJobClass
+ * @parent_class: the parent class
+ * @progress: the class closure for the #FmDeepCountJob::progress signal
+ */
 struct _FmDeepCountJobClass
 {
     /*< private >*/
     FmJobClass parent_class;
+    /*< public >*/
+    void (*progress)(FmDeepCountJob* job);
 };
 
 GType fm_deep_count_job_get_type(void);
@@ -100,6 +109,10 @@ FmDeepCountJob* fm_deep_count_job_new(FmPathList* paths, FmDeepCountJobFlags fla
  */
 void fm_deep_count_job_set_dest(FmDeepCountJob* dc, dev_t dev, const char* fs_id);
 
+gboolean fm_deep_count_job_get_item_totals(FmDeepCountJob* dc, guint n,
+                                           guint* count, goffset* total_size,
+                                           goffset* total_ondisk_size);
+
 G_END_DECLS
 
 #endif /* __FM_DEEP_COUNT_JOB_H__ */
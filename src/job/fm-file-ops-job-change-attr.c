@@ -27,6 +27,8 @@
 #include <glib/gi18n-lib.h>
 
 #include "fm-file-ops-job-change-attr.h"
+#include "fm-file-ops-job-private.h"
+#include "fm-file-ops-job-native.h"
 #include "fm-monitor.h"
 
 static const char query[] =  G_FILE_ATTRIBUTE_STANDARD_TYPE","
@@ -36,6 +38,36 @@ static const char query[] =  G_FILE_ATTRIBUTE_STANDARD_TYPE","
                                G_FILE_ATTRIBUTE_UNIX_MODE","
                                G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME;
 
+/*
+ * _fm_file_ops_job_change_attr_mode
+ * @job: the job
+ * @mode: current mode of file, including its type
+ *
+ * Calculates new mode for file according to fm_file_ops_job_set_chmod().
+ *
+ * Returns: new permissions for the file.
+ */
+mode_t _fm_file_ops_job_change_attr_mode(FmFileOpsJob* job, mode_t mode)
+{
+    gboolean is_dir = S_ISDIR(mode);
+
+    mode &= ~job->new_mode_mask;
+    mode |= (job->new_mode & job->new_mode_mask);
+
+    /* FIXME: this behavior should be optional. */
+    /* treat dirs with 'r' as 'rx' */
+    if(is_dir)
+    {
+        if((job->new_mode_mask & S_IRUSR) && (mode & S_IRUSR))
+            mode |= S_IXUSR;
+        if((job->new_mode_mask & S_IRGRP) && (mode & S_IRGRP))
+            mode |= S_IXGRP;
+        if((job->new_mode_mask & S_IROTH) && (mode & S_IROTH))
+            mode |= S_IXOTH;
+    }
+    return mode & 07777;
+}
+
 static gboolean _fm_file_ops_job_change_attr_file(FmFileOpsJob* job, GFile* gf, GFileInfo* inf)
 {
     GError* err = NULL;
@@ -105,20 +137,7 @@ _retry_change_group:
     if( !fm_job_is_cancelled(fmjob) && job->new_mode_mask )
     {
         guint32 mode = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_UNIX_MODE);
-        mode &= ~job->new_mode_mask;
-        mode |= (job->new_mode & job->new_mode_mask);
-
-        /* FIXME: this behavior should be optional. */
-        /* treat dirs with 'r' as 'rx' */
-        if(type == G_FILE_TYPE_DIRECTORY)
-        {
-            if((job->new_mode_mask & S_IRUSR) && (mode & S_IRUSR))
-                mode |= S_IXUSR;
-            if((job->new_mode_mask & S_IRGRP) && (mode & S_IRGRP))
-                mode |= S_IXGRP;
-            if((job->new_mode_mask & S_IROTH) && (mode & S_IROTH))
-                mode |= S_IXOTH;
-        }
+        mode = _fm_file_ops_job_change_attr_mode(job, mode);
 
         /* new mode */
 _retry_chmod:
@@ -219,7 +238,7 @@ _retry_change_target:
         g_free(basename);
     }
 
-    ++job->finished;
+    _fm_file_ops_job_add_progress(job, 1, 0, 1);
     fm_file_ops_job_emit_percent(job);
 
     if(changed && job->src_folder_mon)
@@ -289,17 +308,19 @@ gboolean _fm_file_ops_job_change_attr_run(FmFileOpsJob* job)
 {
     GList* l;
     GFileMonitor* old_mon;
+    FmChangeAttrEngine* engine = NULL;
+    gboolean ret = TRUE;
 
     /* prepare the job, count total work needed with FmDeepCountJob */
     if(job->recursive)
     {
         FmDeepCountJob* dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_DEFAULT);
         fm_job_run_sync(FM_JOB(dc));
-        job->total = dc->count;
+        _fm_file_ops_job_set_total(job, dc->count);
         g_object_unref(dc);
     }
     else
-        job->total = fm_path_list_get_length(job->srcs);
+        _fm_file_ops_job_set_total(job, fm_path_list_get_length(job->srcs));
 
     g_debug("total number of files to change attribute: %llu", (long long unsigned int)job->total);
 
@@ -325,7 +346,6 @@ gboolean _fm_file_ops_job_change_attr_run(FmFileOpsJob* job)
     }
     for(; ! fm_job_is_cancelled(FM_JOB(job)) && l;l=l->next)
     {
-        gboolean ret;
         GFile* src = fm_path_to_gfile(FM_PATH(l->data));
         job->src_folder_mon = NULL;
         if(!g_file_is_native(src))
@@ -338,7 +358,15 @@ gboolean _fm_file_ops_job_change_attr_run(FmFileOpsJob* job)
             }
         }
 
-        ret = _fm_file_ops_job_change_attr_file(job, src, NULL);
+        /* large trees of local files are changed much faster without GIO,
+           but only owner and permissions can be changed that way */
+        if(job->recursive && g_file_is_native(src) && !job->display_name &&
+           !job->icon && job->set_hidden < 0 && !job->target && !engine)
+            engine = _fm_file_ops_job_change_attr_native_new(job);
+        if(job->recursive && g_file_is_native(src) && engine)
+            ret = _fm_file_ops_job_change_attr_native(engine, src);
+        else
+            ret = _fm_file_ops_job_change_attr_file(job, src, NULL);
         g_object_unref(src);
 
         if(job->src_folder_mon)
@@ -346,7 +374,9 @@ gboolean _fm_file_ops_job_change_attr_run(FmFileOpsJob* job)
         job->src_folder_mon = old_mon;
 
         if(!ret) /* error! */
-            return FALSE;
+            break;
     }
-    return TRUE;
+    if(engine)
+        _fm_file_ops_job_change_attr_native_free(engine);
+    return ret;
 }
@@ -25,7 +25,9 @@
 #endif
 
 #include "fm-file-ops-job-delete.h"
+#include "fm-file-ops-job-private.h"
 #include "fm-file-ops-job-xfer.h"
+#include "fm-file-ops-job-native.h"
 #include "fm-monitor.h"
 #include "fm-config.h"
 #include "fm-file.h"
@@ -67,7 +69,7 @@ gboolean _fm_file_ops_job_delete_file(FmJob* job, GFile* gf, GFileInfo* inf)
         g_free(basename);
         fm_file_ops_job_emit_cur_file(fjob, disp);
         g_free(disp);
-        ++fjob->finished;
+        _fm_file_ops_job_add_progress(fjob, 1, 0, 1);
         return FALSE;
     }
 
@@ -75,7 +77,7 @@ gboolean _fm_file_ops_job_delete_file(FmJob* job, GFile* gf, GFileInfo* inf)
     fm_file_ops_job_emit_cur_file(fjob, g_file_info_get_display_name(inf));
 
     /* show progress */
-    ++fjob->finished;
+    _fm_file_ops_job_add_progress(fjob, 1, 0, 1);
     fm_file_ops_job_emit_percent(fjob);
 
     is_dir = (g_file_info_get_file_type(inf)==G_FILE_TYPE_DIRECTORY);
@@ -213,24 +215,13 @@ gboolean _fm_file_ops_job_delete_run(FmFileOpsJob* job)
 {
     GList* l;
     gboolean ret = TRUE;
-    /* prepare the job, count total work needed with FmDeepCountJob */
-    FmDeepCountJob* dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_PREPARE_DELETE);
     FmJob* fmjob = FM_JOB(job);
     GFileMonitor* old_mon;
+    FmDeleteEngine* engine = NULL;
 
-    /* let the deep count job share the same cancellable */
-    fm_job_set_cancellable(FM_JOB(dc), fm_job_get_cancellable(fmjob));
-    fm_job_run_sync(FM_JOB(dc));
-    job->total = dc->count;
-    g_object_unref(dc);
-
-    if(fm_job_is_cancelled(fmjob))
-    {
-        g_debug("delete job is cancelled");
-        return FALSE;
-    }
-
-    g_debug("total number of files to delete: %llu", (long long unsigned int)job->total);
+    /* count total number of files with FmDeepCountJob while deleting */
+    _fm_file_ops_job_start_count(job, fm_deep_count_job_new(job->srcs, FM_DC_JOB_PREPARE_DELETE),
+                                 TRUE);
 
     fm_file_ops_job_emit_prepared(job);
 
@@ -251,13 +242,32 @@ gboolean _fm_file_ops_job_delete_run(FmFileOpsJob* job)
             }
         }
 
-        ret = _fm_file_ops_job_delete_file(fmjob, src, NULL);
+        /* local trees are removed much faster without GIO */
+        if((g_file_is_native(src) || fm_path_is_trash_root(FM_PATH(l->data))) &&
+           !engine)
+            engine = _fm_file_ops_job_delete_native_new(job);
+        if(g_file_is_native(src) && engine)
+            ret = _fm_file_ops_job_delete_native(engine, src);
+        else if(fm_path_is_trash_root(FM_PATH(l->data)) && engine)
+        {
+            /* empty the trash cans directly instead of trash:/// items */
+            char* disp = fm_path_display_basename(FM_PATH(l->data));
+            fm_file_ops_job_emit_cur_file(job, disp);
+            g_free(disp);
+            ret = _fm_file_ops_job_empty_trash_native(engine);
+        }
+        else
+            ret = _fm_file_ops_job_delete_file(fmjob, src, NULL);
         g_object_unref(src);
 
         if(job->src_folder_mon)
             g_object_unref(job->src_folder_mon);
     }
     job->src_folder_mon = old_mon;
+    if(engine)
+        _fm_file_ops_job_delete_native_free(engine);
+    _fm_file_ops_job_finish_count(job);
+    fm_file_ops_job_emit_percent(job);
     return ret;
 }
 
@@ -268,8 +278,13 @@ gboolean _fm_file_ops_job_trash_run(FmFileOpsJob* job)
     FmPathList* unsupported = fm_path_list_new();
     GError* err = NULL;
     FmJob* fmjob = FM_JOB(job);
+    FmTrashEngine* engine;
     g_debug("total number of files to delete: %u", fm_path_list_get_length(job->srcs));
-    job->total = fm_path_list_get_length(job->srcs);
+    _fm_file_ops_job_set_total(job, fm_path_list_get_length(job->srcs));
+
+    /* local files are moved into trash cans directly, GIO queries each
+       trash can for each file again and is very slow with many files */
+    engine = _fm_file_ops_job_trash_native_new(job);
 
     fm_file_ops_job_emit_prepared(job);
 
@@ -279,16 +294,25 @@ gboolean _fm_file_ops_job_trash_run(FmFileOpsJob* job)
     for(; !fm_job_is_cancelled(fmjob) && l;l=l->next)
     {
         GFile* gf = fm_path_to_gfile(FM_PATH(l->data));
+        gboolean native = fm_path_is_native(FM_PATH(l->data));
         GFileInfo* inf;
 _retry_trash:
-        inf = g_file_query_info(gf, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME, 0, fmjob->cancellable, &err);
+        if(native) /* display name of local file is known without query */
+        {
+            char* disp = fm_path_display_basename(FM_PATH(l->data));
+            fm_file_ops_job_emit_cur_file(job, disp);
+            g_free(disp);
+            inf = NULL;
+        }
+        else
+            inf = g_file_query_info(gf, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME, 0, fmjob->cancellable, &err);
         if(inf)
         {
             /* currently processed file. */
             fm_file_ops_job_emit_cur_file(job, g_file_info_get_display_name(inf));
             g_object_unref(inf);
         }
-        else
+        else if(!native)
         {
             char* basename = g_file_get_basename(gf);
             char* disp = g_filename_display_name(basename);
@@ -317,7 +341,14 @@ _retry_trash:
             }
         }
 
-        if(!ret)
+        if(!ret && native && engine)
+        {
+            ret = _fm_file_ops_job_trash_native(engine, gf, &err);
+            /* no trash can for the file, GIO may know better */
+            if(!ret && g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+                g_clear_error(&err);
+        }
+        if(!ret && !err)
             ret = g_file_trash(gf, fm_job_get_cancellable(fmjob), &err);
         if(!ret)
         {
@@ -336,6 +367,8 @@ _on_error:
                 {
                     g_object_unref(gf);
                     fm_path_list_unref(unsupported);
+                    if(engine)
+                        _fm_file_ops_job_trash_native_free(engine);
                     return FALSE;
                 }
             }
@@ -343,9 +376,11 @@ _on_error:
             err = NULL;
         }
         g_object_unref(gf);
-        ++job->finished;
+        _fm_file_ops_job_add_progress(job, 1, 0, 1);
         fm_file_ops_job_emit_percent(job);
     }
+    if(engine)
+        _fm_file_ops_job_trash_native_free(engine);
 
     /* these files cannot be trashed due to lack of support from
      * underlying file systems. */
@@ -403,7 +438,7 @@ gboolean _fm_file_ops_job_untrash_run(FmFileOpsJob* job)
     GList* l;
     GError* err = NULL;
     FmJob* fmjob = FM_JOB(job);
-    job->total = fm_path_list_get_length(job->srcs);
+    _fm_file_ops_job_set_total(job, fm_path_list_get_length(job->srcs));
     fm_file_ops_job_emit_prepared(job);
 
     l = fm_path_list_peek_head_link(job->srcs);
@@ -473,7 +508,7 @@ _retry_get_orig_path:
             }
         }
         g_object_unref(gf);
-        ++job->finished;
+        _fm_file_ops_job_add_progress(job, 1, 0, 1);
         fm_file_ops_job_emit_percent(job);
     }
 
@@ -0,0 +1,231 @@
+/*
+ *      fm-file-ops-job-journal.c
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* The journal is a text file in $XDG_CACHE_HOME/libfm/journal named by
+ * checksum of the job sources and destination. Each line is a record:
+ *     <type> <offset> <size> <mtime> <destination URI>
+ * where type is 'D' for completely copied files or 'P' for a checkpoint
+ * of partially copied one. Records are only appended, the last record for
+ * the destination is valid. Journals of jobs which were never resumed are
+ * removed when they become too old. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fm-file-ops-job-journal.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+/* journals not changed for that long are removed, in seconds */
+#define JOURNAL_MAX_AGE (30 * 24 * 60 * 60)
+
+struct _FmFileOpsJournal
+{
+    char* path;
+    FILE* f;
+    GHashTable* records; /* URI -> FmFileOpsJournalRecord */
+};
+
+/* records are added by many workers of copy pool */
+G_LOCK_DEFINE_STATIC(journal);
+
+static void journal_record_free(gpointer data)
+{
+    g_slice_free(FmFileOpsJournalRecord, data);
+}
+
+static void journal_load(FmFileOpsJournal* journal)
+{
+    char *contents, *line, *next, *p;
+    FmFileOpsJournalRecord* rec;
+
+    if(!g_file_get_contents(journal->path, &contents, NULL, NULL))
+        return;
+    for(line = contents; line && *line; line = next)
+    {
+        next = strchr(line, '\n');
+        if(!next) /* incomplete record, it was interrupted */
+            break;
+        *next++ = '\0';
+        if((line[0] != 'D' && line[0] != 'P') || line[1] != ' ')
+            continue;
+        rec = g_slice_new(FmFileOpsJournalRecord);
+        rec->done = (line[0] == 'D');
+        p = line + 2;
+        rec->offset = g_ascii_strtoll(p, &p, 10);
+        rec->size = g_ascii_strtoll(p, &p, 10);
+        rec->mtime = g_ascii_strtoull(p, &p, 10);
+        if(*p != ' ' || p[1] == '\0')
+        {
+            journal_record_free(rec);
+            continue;
+        }
+        g_hash_table_replace(journal->records, g_strdup(p + 1), rec);
+    }
+    g_free(contents);
+}
+
+/* removes journals left by jobs which were never resumed */
+static void journal_expire(const char* dir_path)
+{
+    GDir* dir = g_dir_open(dir_path, 0, NULL);
+    const char* name;
+    char* path;
+    struct stat st;
+    time_t expired = time(NULL) - JOURNAL_MAX_AGE;
+
+    if(!dir)
+        return;
+    while((name = g_dir_read_name(dir)) != NULL)
+    {
+        path = g_build_filename(dir_path, name, NULL);
+        if(g_lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime < expired)
+            g_unlink(path);
+        g_free(path);
+    }
+    g_dir_close(dir);
+}
+
+/*
+ * _fm_file_ops_job_journal_open
+ * @job: the copy or move job
+ *
+ * Opens the journal for @job and loads records left by previous run of
+ * the job with the same sources and destination, if any. Journals which
+ * were not changed for a long time are removed before that.
+ *
+ * Returns: journal or %NULL if it cannot be created.
+ */
+FmFileOpsJournal* _fm_file_ops_job_journal_open(FmFileOpsJob* job)
+{
+    FmFileOpsJournal* journal;
+    GChecksum* sum;
+    GList* l;
+    char *dir, *str;
+
+    dir = g_build_filename(g_get_user_cache_dir(), "libfm", "journal", NULL);
+    if(g_mkdir_with_parents(dir, 0700) < 0)
+    {
+        g_free(dir);
+        return NULL;
+    }
+    journal_expire(dir);
+    sum = g_checksum_new(G_CHECKSUM_SHA1);
+    for(l = fm_path_list_peek_head_link(job->srcs); l; l = l->next)
+    {
+        str = fm_path_to_str(FM_PATH(l->data));
+        g_checksum_update(sum, (const guchar*)str, -1);
+        g_checksum_update(sum, (const guchar*)"\n", 1);
+        g_free(str);
+    }
+    str = fm_path_to_str(job->dest);
+    g_checksum_update(sum, (const guchar*)str, -1);
+    g_free(str);
+
+    journal = g_slice_new(FmFileOpsJournal);
+    journal->path = g_build_filename(dir, g_checksum_get_string(sum), NULL);
+    g_checksum_free(sum);
+    g_free(dir);
+    journal->records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             journal_record_free);
+    journal_load(journal);
+    journal->f = g_fopen(journal->path, "a");
+    if(!journal->f)
+    {
+        _fm_file_ops_job_journal_close(journal, FALSE);
+        return NULL;
+    }
+    g_debug("journal %s: %u records loaded", journal->path,
+            g_hash_table_size(journal->records));
+    return journal;
+}
+
+/*
+ * _fm_file_ops_job_journal_close
+ * @journal: the journal
+ * @finished: %TRUE if the job is successfully finished
+ *
+ * Closes the @journal. If @finished is %TRUE then it is also removed.
+ */
+void _fm_file_ops_job_journal_close(FmFileOpsJournal* journal, gboolean finished)
+{
+    if(journal->f)
+        fclose(journal->f);
+    if(finished)
+        g_unlink(journal->path);
+    g_hash_table_destroy(journal->records);
+    g_free(journal->path);
+    g_slice_free(FmFileOpsJournal, journal);
+}
+
+/*
+ * _fm_file_ops_job_journal_lookup
+ * @journal: the journal
+ * @dest: destination file
+ *
+ * Finds what was done with @dest by previous run of the job.
+ *
+ * Returns: the record or %NULL if @dest was not copied before.
+ */
+const FmFileOpsJournalRecord* _fm_file_ops_job_journal_lookup(FmFileOpsJournal* journal,
+                                                              GFile* dest)
+{
+    const FmFileOpsJournalRecord* rec;
+    char* uri;
+
+    /* records are loaded only once so no lock is needed */
+    if(g_hash_table_size(journal->records) == 0)
+        return NULL;
+    uri = g_file_get_uri(dest);
+    rec = g_hash_table_lookup(journal->records, uri);
+    g_free(uri);
+    return rec;
+}
+
+/*
+ * _fm_file_ops_job_journal_add
+ * @journal: the journal
+ * @dest: destination file
+ * @done: %TRUE if @dest is completely copied
+ * @offset: length of data written into @dest
+ * @size: size of the source file
+ * @mtime: modification time of the source file
+ *
+ * Appends new record about @dest. For partially copied file caller should
+ * make sure data up to @offset is on the disk.
+ */
+void _fm_file_ops_job_journal_add(FmFileOpsJournal* journal, GFile* dest,
+                                  gboolean done, goffset offset, goffset size,
+                                  guint64 mtime)
+{
+    char* uri = g_file_get_uri(dest);
+
+    G_LOCK(journal);
+    fprintf(journal->f, "%c %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GUINT64_FORMAT " %s\n",
+            done ? 'D' : 'P', (gint64)offset, (gint64)size, mtime, uri);
+    fflush(journal->f);
+    G_UNLOCK(journal);
+    g_free(uri);
+}
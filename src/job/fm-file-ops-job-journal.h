@@ -0,0 +1,54 @@
+/*
+ *      fm-file-ops-job-journal.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_FILE_OPS_JOB_JOURNAL_H__
+#define __FM_FILE_OPS_JOB_JOURNAL_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "fm-file-ops-job.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FmFileOpsJournal FmFileOpsJournal;
+typedef struct _FmFileOpsJournalRecord FmFileOpsJournalRecord;
+
+/* state of destination file written by previous run of the same job */
+struct _FmFileOpsJournalRecord
+{
+    gboolean done; /* the file is completely copied */
+    goffset offset; /* length of data safely written */
+    goffset size; /* size of the source file */
+    guint64 mtime; /* modification time of the source file */
+};
+
+FmFileOpsJournal* _fm_file_ops_job_journal_open(FmFileOpsJob* job);
+void _fm_file_ops_job_journal_close(FmFileOpsJournal* journal, gboolean finished);
+
+const FmFileOpsJournalRecord* _fm_file_ops_job_journal_lookup(FmFileOpsJournal* journal,
+                                                              GFile* dest);
+void _fm_file_ops_job_journal_add(FmFileOpsJournal* journal, GFile* dest,
+                                  gboolean done, goffset offset, goffset size,
+                                  guint64 mtime);
+
+G_END_DECLS
+
+#endif
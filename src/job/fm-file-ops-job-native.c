@@ -0,0 +1,1739 @@
+/*
+ *      fm-file-ops-job-native.c
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fm-file-ops-job-native.h"
+#include "fm-file-ops-job-private.h"
+#include "fm-file-ops-job-journal.h"
+#include "fm-file-ops-job-change-attr.h"
+#include "fm-trash.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib/gi18n-lib.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+/* max size passed to kernel at once, cancellation is checked between chunks */
+#define NATIVE_COPY_CHUNK (16 * 1024 * 1024)
+/* buffer size for the last resort read/write loop, it grows while reads
+   fill it up to the max, larger for streamed files */
+#define NATIVE_COPY_BUFFER_MIN (64 * 1024)
+#define NATIVE_COPY_BUFFER_MAX (1024 * 1024)
+#define STREAMING_BUFFER_MAX (4 * 1024 * 1024)
+/* files larger than that are streamed: their data are dropped from the
+   page cache after being copied so the working set of other programs is
+   not evicted by single big copy */
+#define STREAMING_THRESHOLD (64 * 1024 * 1024)
+/* how much of streamed file may be in the page cache */
+#define STREAMING_WINDOW (8 * 1024 * 1024)
+/* buffer for copying with O_DIRECT and its alignment */
+#define DIRECT_IO_BUFFER (4 * 1024 * 1024)
+#define DIRECT_IO_ALIGN 4096
+/* how often partially copied file is recorded in the journal */
+#define JOURNAL_CHECKPOINT_SIZE (64 * 1024 * 1024)
+/* size of data compared before partially copied file is resumed */
+#define RESUME_VERIFY_SIZE (64 * 1024)
+
+#ifndef HAVE_FDATASYNC
+# define fdatasync fsync
+#endif
+
+/* state of a single file being copied */
+typedef struct
+{
+    FmFileOpsJob* job;
+    int src_fd;
+    int dest_fd;
+    goffset size;
+    GFileProgressCallback progress;
+    gpointer progress_data;
+    /* for the journal, NULL if the file is not resumable */
+    GFile* dest;
+    guint64 mtime;
+    goffset checkpoint; /* offset recorded in the journal */
+    /* for streaming */
+    gboolean streaming;
+    goffset written_back; /* writeback of dest is started up to here */
+    goffset dropped; /* page cache is dropped up to here */
+} FmNativeCopy;
+
+static inline void set_error_from_errno(GError** error, int errsv)
+{
+    g_set_error_literal(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                        g_strerror(errsv));
+}
+
+/* returns TRUE if errno means the method cannot be used for those files */
+static inline gboolean is_method_unsupported(int errsv)
+{
+    return (errsv == ENOSYS || errsv == EXDEV || errsv == EINVAL ||
+            errsv == EOPNOTSUPP || errsv == ENOTSUP || errsv == EBADF);
+}
+
+/* drops copied data of streamed file from the page cache; writeback of
+   the destination is started for the last window and waited for the one
+   before it, so the amount of dirty pages stays limited too */
+static void drop_cache(FmNativeCopy* cp, goffset offset)
+{
+#ifdef HAVE_POSIX_FADVISE
+    if(!cp->streaming || offset - cp->written_back < STREAMING_WINDOW)
+        return;
+    posix_fadvise(cp->src_fd, cp->written_back, offset - cp->written_back,
+                  POSIX_FADV_DONTNEED);
+#ifdef HAVE_SYNC_FILE_RANGE
+    sync_file_range(cp->dest_fd, cp->written_back, offset - cp->written_back,
+                    SYNC_FILE_RANGE_WRITE);
+    if(cp->written_back > cp->dropped)
+    {
+        sync_file_range(cp->dest_fd, cp->dropped, cp->written_back - cp->dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(cp->dest_fd, cp->dropped, cp->written_back - cp->dropped,
+                      POSIX_FADV_DONTNEED);
+    }
+#endif
+    cp->dropped = cp->written_back;
+    cp->written_back = offset;
+#endif
+}
+
+static gboolean report_progress(FmNativeCopy* cp, goffset offset, GError** error)
+{
+    FmFileOpsJournal* journal = (FmFileOpsJournal*)cp->job->journal;
+
+    drop_cache(cp, offset);
+    if(cp->progress)
+        cp->progress(offset, MAX(offset, cp->size), cp->progress_data);
+    if(journal && cp->dest && offset - cp->checkpoint >= JOURNAL_CHECKPOINT_SIZE &&
+       /* data should be on the disk before it is recorded */
+       fdatasync(cp->dest_fd) == 0)
+    {
+        _fm_file_ops_job_journal_add(journal, cp->dest, FALSE, offset,
+                                     cp->size, cp->mtime);
+        cp->checkpoint = offset;
+    }
+    return !g_cancellable_set_error_if_cancelled(fm_job_get_cancellable(FM_JOB(cp->job)),
+                                                 error);
+}
+
+static gboolean write_all(int fd, const char* buf, gssize len, GError** error)
+{
+    gssize n;
+
+    while(len > 0)
+    {
+        n = write(fd, buf, len);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            set_error_from_errno(error, errno);
+            return FALSE;
+        }
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* copies data from current positions of files until end is reached, or
+   until EOF if end is negative; tries the in-kernel copy first, then
+   falls back to userspace loop */
+static gboolean copy_range(FmNativeCopy* cp, goffset* offset, goffset end,
+                           GError** error)
+{
+    gssize n;
+    gsize buf_size, max_size;
+    char* buf;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    while(*offset < end)
+    {
+        n = copy_file_range(cp->src_fd, NULL, cp->dest_fd, NULL,
+                            MIN(end - *offset, NATIVE_COPY_CHUNK), 0);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(is_method_unsupported(errno))
+                break; /* file offsets are intact, try next method */
+            set_error_from_errno(error, errno);
+            return FALSE;
+        }
+        if(n == 0) /* EOF or unsupported; let next method decide */
+            break;
+        *offset += n;
+        if(!report_progress(cp, *offset, error))
+            return FALSE;
+    }
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+    while(*offset < end)
+    {
+        n = sendfile(cp->dest_fd, cp->src_fd, NULL, MIN(end - *offset, NATIVE_COPY_CHUNK));
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(is_method_unsupported(errno))
+                break;
+            set_error_from_errno(error, errno);
+            return FALSE;
+        }
+        if(n == 0)
+            break;
+        *offset += n;
+        if(!report_progress(cp, *offset, error))
+            return FALSE;
+    }
+#endif
+    if(end >= 0 && *offset >= end)
+        return TRUE;
+
+    /* small files don't need big buffer, and for big ones fewer syscalls
+       matter more than memory */
+    buf_size = NATIVE_COPY_BUFFER_MIN;
+    max_size = cp->streaming ? STREAMING_BUFFER_MAX : NATIVE_COPY_BUFFER_MAX;
+    buf = g_malloc(buf_size);
+    for(;;)
+    {
+        n = read(cp->src_fd, buf,
+                 end < 0 ? buf_size : MIN((gsize)(end - *offset), buf_size));
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            set_error_from_errno(error, errno);
+            break;
+        }
+        if(n == 0) /* EOF or end reached */
+        {
+            g_free(buf);
+            return TRUE;
+        }
+        if(!write_all(cp->dest_fd, buf, n, error))
+            break;
+        *offset += n;
+        if(!report_progress(cp, *offset, error))
+            break;
+        if((gsize)n == buf_size && buf_size < max_size)
+        {
+            buf_size *= 2;
+            g_free(buf);
+            buf = g_malloc(buf_size);
+        }
+    }
+    g_free(buf);
+    return FALSE;
+}
+
+#ifdef O_DIRECT
+static inline void set_direct(int fd, int flags, gboolean direct)
+{
+    fcntl(fd, F_SETFL, direct ? (flags | O_DIRECT) : flags);
+}
+
+/* copies data bypassing the page cache; returns -1 if the filesystem
+   does not support O_DIRECT or the offset became unaligned, so the rest
+   should be copied by other methods */
+static int copy_direct(FmNativeCopy* cp, goffset* offset, GError** error)
+{
+    int src_flags, dest_flags, errsv;
+    goffset start = *offset;
+    gpointer buf;
+    gssize n;
+    gboolean unaligned;
+    int ret = 0;
+
+    /* everything should be aligned, the tail is handled below */
+    if(start % DIRECT_IO_ALIGN != 0)
+        return -1;
+    src_flags = fcntl(cp->src_fd, F_GETFL);
+    dest_flags = fcntl(cp->dest_fd, F_GETFL);
+    if(src_flags < 0 || dest_flags < 0 ||
+       fcntl(cp->src_fd, F_SETFL, src_flags | O_DIRECT) < 0)
+        return -1;
+    if(fcntl(cp->dest_fd, F_SETFL, dest_flags | O_DIRECT) < 0 ||
+       posix_memalign(&buf, DIRECT_IO_ALIGN, DIRECT_IO_BUFFER) != 0)
+    {
+        set_direct(cp->src_fd, src_flags, FALSE);
+        set_direct(cp->dest_fd, dest_flags, FALSE);
+        return -1;
+    }
+    for(;;)
+    {
+        n = read(cp->src_fd, buf, DIRECT_IO_BUFFER);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            errsv = errno;
+            if(errsv == EINVAL && *offset == start)
+                ret = -1; /* refused by filesystem */
+            else
+                set_error_from_errno(error, errsv);
+            break;
+        }
+        if(n == 0) /* EOF reached */
+        {
+            ret = 1;
+            break;
+        }
+        /* the tail or a short read is not aligned so neither it nor
+           anything after it can be read or written directly */
+        unaligned = (n % DIRECT_IO_ALIGN != 0);
+        if(unaligned)
+        {
+            set_direct(cp->src_fd, src_flags, FALSE);
+            set_direct(cp->dest_fd, dest_flags, FALSE);
+        }
+        if(!write_all(cp->dest_fd, buf, n, error))
+        {
+            if(*offset == start && g_error_matches(*error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT) &&
+               lseek(cp->src_fd, start, SEEK_SET) >= 0 &&
+               lseek(cp->dest_fd, start, SEEK_SET) >= 0)
+            {
+                g_clear_error(error);
+                ret = -1;
+            }
+            break;
+        }
+        *offset += n;
+        if(!report_progress(cp, *offset, error))
+            break;
+        if(unaligned) /* the rest is copied through the page cache */
+        {
+            ret = -1;
+            break;
+        }
+    }
+    free(buf);
+    set_direct(cp->src_fd, src_flags, FALSE);
+    set_direct(cp->dest_fd, dest_flags, FALSE);
+    return ret;
+}
+#endif
+
+#ifdef SEEK_HOLE
+/* copies only data segments of sparse source, holes are left unallocated
+   in the destination; returns -1 if the filesystem cannot find holes */
+static int copy_sparse(FmNativeCopy* cp, goffset* offset, GError** error)
+{
+    off_t data, hole;
+
+    while(*offset < cp->size)
+    {
+        data = lseek(cp->src_fd, *offset, SEEK_DATA);
+        if(data < 0)
+        {
+            if(errno != ENXIO) /* no support, restore position */
+            {
+                if(lseek(cp->src_fd, *offset, SEEK_SET) >= 0)
+                    return -1;
+                set_error_from_errno(error, errno);
+                return 0;
+            }
+            data = cp->size; /* there is only hole till the end */
+        }
+        if(data > *offset)
+        {
+            /* extend the file instead of writing zeros, it keeps the size
+               consistent with the offset for the journal as well */
+            if(ftruncate(cp->dest_fd, MIN(data, cp->size)) < 0 ||
+               lseek(cp->dest_fd, data, SEEK_SET) < 0)
+            {
+                set_error_from_errno(error, errno);
+                return 0;
+            }
+            *offset = MIN(data, cp->size);
+            /* holes are counted as done since logical size is the total */
+            if(!report_progress(cp, *offset, error))
+                return 0;
+            if(*offset >= cp->size)
+                break;
+        }
+        hole = lseek(cp->src_fd, data, SEEK_HOLE);
+        if(hole < 0 || hole > cp->size) /* the file was changed meanwhile */
+            hole = cp->size;
+        if(lseek(cp->src_fd, data, SEEK_SET) < 0)
+        {
+            set_error_from_errno(error, errno);
+            return 0;
+        }
+        if(!copy_range(cp, offset, hole, error))
+            return 0;
+    }
+    return 1;
+}
+#endif
+
+/* copies content of source into destination starting from offset, tries
+   the fastest way first: shared extents (reflink), then in-kernel copy,
+   then userspace loop; holes of sparse files are preserved */
+static gboolean copy_data(FmNativeCopy* cp, goffset offset, gboolean sparse,
+                          GError** error)
+{
+
+    /* files like ones in /proc report zero size but have content so they
+       can be copied only by reading until EOF */
+    if(cp->size > 0)
+    {
+#ifdef FICLONE
+        /* on CoW filesystems (btrfs, XFS) the copy is nearly free */
+        if(offset == 0 && ioctl(cp->dest_fd, FICLONE, cp->src_fd) == 0)
+            return report_progress(cp, cp->size, error);
+#endif
+#ifdef O_DIRECT
+        /* holes are preferred over bypassing the cache */
+        if(cp->job->direct_io_threshold > 0 &&
+           cp->size >= cp->job->direct_io_threshold && !sparse)
+        {
+            switch(copy_direct(cp, &offset, error))
+            {
+            case 0:
+                return FALSE;
+            case 1:
+                return TRUE;
+            }
+        }
+#endif
+#ifdef SEEK_HOLE
+        if(sparse)
+        {
+            switch(copy_sparse(cp, &offset, error))
+            {
+            case 0:
+                return FALSE;
+            case 1:
+                return TRUE;
+            }
+        }
+#endif
+        if(!copy_range(cp, &offset, cp->size, error))
+            return FALSE;
+        if(offset >= cp->size)
+            return TRUE;
+    }
+    return copy_range(cp, &offset, -1, error);
+}
+
+/* reopens file partially copied by previous run of the job if the journal
+   has a record for it and its tail matches the source; on success both
+   files are positioned at the offset to continue from, since all methods
+   of copy_data() work on the file positions rather than on explicit
+   offsets as pread() and pwrite() would */
+static int resume_dest(FmNativeCopy* cp, const char* dest_path, goffset* offset)
+{
+    const FmFileOpsJournalRecord* rec;
+    struct stat st;
+    char *src_buf, *dest_buf;
+    gssize len;
+    gboolean ok;
+    int fd;
+
+    rec = _fm_file_ops_job_journal_lookup((FmFileOpsJournal*)cp->job->journal, cp->dest);
+    if(!rec || rec->done || rec->offset <= 0 || rec->size != cp->size ||
+       rec->mtime != cp->mtime)
+        return -1;
+    fd = open(dest_path, O_RDWR | O_NOFOLLOW);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < rec->offset)
+        goto _failed;
+    /* cheap verification: compare the last block before the offset */
+    len = MIN(rec->offset, RESUME_VERIFY_SIZE);
+    src_buf = g_malloc(len);
+    dest_buf = g_malloc(len);
+    ok = (pread(cp->src_fd, src_buf, len, rec->offset - len) == len &&
+          pread(fd, dest_buf, len, rec->offset - len) == len &&
+          memcmp(src_buf, dest_buf, len) == 0);
+    g_free(src_buf);
+    g_free(dest_buf);
+    /* anything after the checkpoint may be not written correctly */
+    if(!ok || ftruncate(fd, rec->offset) < 0 ||
+       lseek(fd, rec->offset, SEEK_SET) < 0 ||
+       lseek(cp->src_fd, rec->offset, SEEK_SET) < 0)
+        goto _failed;
+    g_debug("resuming copy of %s from %" G_GINT64_FORMAT, dest_path, (gint64)rec->offset);
+    *offset = rec->offset;
+    return fd;
+
+_failed:
+    close(fd);
+    return -1;
+}
+
+/*
+ * _fm_file_ops_job_copy_native
+ * @job: the job
+ * @src: source file
+ * @dest: destination file
+ * @flags: flags for copying
+ * @progress: callback to report progress
+ * @progress_data: data for @progress
+ * @error: location to store error
+ *
+ * Copies regular file between two local paths using the kernel facilities.
+ * If the journal is enabled for @job then the file may be resumed from the
+ * point where previous run of the job stopped, see
+ * fm_file_ops_job_set_resumable().
+ *
+ * Returns: %TRUE if file was copied. Fails with %G_IO_ERROR_NOT_SUPPORTED
+ * if g_file_copy() should be used instead.
+ */
+gboolean _fm_file_ops_job_copy_native(FmFileOpsJob* job, GFile* src, GFile* dest,
+                                      GFileCopyFlags flags,
+                                      GFileProgressCallback progress,
+                                      gpointer progress_data, GError** error)
+{
+    char *src_path, *dest_path, *tmp_path = NULL;
+    struct stat src_st, dest_st;
+    FmNativeCopy cp;
+    goffset offset = 0;
+    gboolean ret = FALSE;
+
+    cp.src_fd = -1;
+    src_path = g_file_get_path(src);
+    dest_path = g_file_get_path(dest);
+    if(!src_path || !dest_path)
+        goto _not_supported;
+    /* symlinks and special files are left to GIO, as well as any problem
+       with the source file, so errors are reported in the usual way */
+    if(lstat(src_path, &src_st) < 0 || !S_ISREG(src_st.st_mode))
+        goto _not_supported;
+    cp.src_fd = open(src_path, O_RDONLY | O_NOFOLLOW);
+    if(cp.src_fd < 0 || fstat(cp.src_fd, &src_st) < 0 || !S_ISREG(src_st.st_mode))
+        goto _not_supported;
+    cp.job = job;
+    cp.size = src_st.st_size;
+    cp.progress = progress;
+    cp.progress_data = progress_data;
+    cp.dest = dest;
+    cp.mtime = src_st.st_mtime;
+    cp.checkpoint = 0;
+    cp.streaming = (cp.size >= STREAMING_THRESHOLD);
+#ifdef HAVE_POSIX_FADVISE
+    if(cp.streaming)
+        posix_fadvise(cp.src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    cp.dest_fd = job->journal ? resume_dest(&cp, dest_path, &offset) : -1;
+    if(cp.dest_fd < 0)
+    {
+        if((flags & G_FILE_COPY_OVERWRITE) && lstat(dest_path, &dest_st) == 0)
+        {
+            /* GIO knows how to replace other file types and refuses to copy
+               the file onto itself */
+            if(!S_ISREG(dest_st.st_mode) ||
+               (dest_st.st_dev == src_st.st_dev && dest_st.st_ino == src_st.st_ino))
+                goto _not_supported;
+            /* the existing file is kept until the copy is complete and then
+               replaced at once, which doesn't affect its hard links either;
+               such a copy cannot be resumed since it has no final name yet */
+            tmp_path = g_strconcat(dest_path, ".XXXXXX", NULL);
+            cp.dest_fd = g_mkstemp_full(tmp_path, O_WRONLY, 0600);
+            cp.dest = NULL;
+        }
+        else /* access is granted to the owner only until attributes are copied */
+            cp.dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+        if(cp.dest_fd < 0)
+        {
+            /* EEXIST becomes G_IO_ERROR_EXISTS so caller will ask user */
+            set_error_from_errno(error, errno);
+            goto _out;
+        }
+    }
+    else
+    {
+        cp.checkpoint = offset;
+        if(progress)
+            progress(offset, cp.size, progress_data);
+    }
+    cp.written_back = cp.dropped = offset;
+    /* a file with less blocks allocated than its size has holes */
+    ret = copy_data(&cp, offset, (goffset)src_st.st_blocks * 512 < src_st.st_size,
+                    error);
+    /* close() may report delayed write errors on network filesystems */
+    if(close(cp.dest_fd) < 0 && ret)
+    {
+        set_error_from_errno(error, errno);
+        ret = FALSE;
+    }
+    if(ret && tmp_path && rename(tmp_path, dest_path) < 0)
+    {
+        set_error_from_errno(error, errno);
+        ret = FALSE;
+    }
+    if(ret)
+    {
+        /* failure to copy metadata is not a hard error, same as in GIO */
+        g_file_copy_attributes(src, dest, flags,
+                               fm_job_get_cancellable(FM_JOB(job)), NULL);
+    }
+    /* don't leave partial file unless it can be resumed later */
+    else if(tmp_path)
+        unlink(tmp_path);
+    else if(cp.checkpoint == 0)
+        unlink(dest_path);
+    goto _out;
+
+_not_supported:
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        g_strerror(ENOTSUP));
+_out:
+    if(cp.src_fd >= 0)
+        close(cp.src_fd);
+    g_free(src_path);
+    g_free(dest_path);
+    g_free(tmp_path);
+    return ret;
+}
+
+/*
+ * _fm_file_ops_job_rename_native
+ * @src_path: file to move
+ * @dest_path: new path for the file
+ *
+ * Renames file within the same filesystem, never replaces existing file.
+ *
+ * Returns: %TRUE on success, otherwise errno is set.
+ */
+gboolean _fm_file_ops_job_rename_native(const char* src_path, const char* dest_path)
+{
+    struct stat st;
+
+#if defined(HAVE_RENAMEAT2) && defined(RENAME_NOREPLACE)
+    if(renameat2(AT_FDCWD, src_path, AT_FDCWD, dest_path, RENAME_NOREPLACE) == 0)
+        return TRUE;
+    /* old kernel or filesystem which doesn't support the flag */
+    if(errno != ENOSYS && errno != EINVAL)
+        return FALSE;
+#endif
+    /* same check as GIO does */
+    if(lstat(dest_path, &st) == 0)
+    {
+        errno = EEXIST;
+        return FALSE;
+    }
+    return (rename(src_path, dest_path) == 0);
+}
+
+/* ---- common for recursive operations ---- */
+
+#if defined(HAVE_UNLINKAT) && defined(HAVE_FDOPENDIR)
+# define HAVE_NATIVE_DELETE 1
+#endif
+#if defined(HAVE_FCHMODAT) && defined(HAVE_FCHOWNAT) && defined(HAVE_FDOPENDIR)
+# define HAVE_NATIVE_CHANGE_ATTR 1
+#endif
+
+/* max number of threads processing subtrees concurrently */
+#define NATIVE_MAX_WORKERS 8
+/* number of processed entries reported to the job at once */
+#define NATIVE_PROGRESS_BATCH 256
+
+typedef struct _FmNativeWalker FmNativeWalker;
+typedef struct _FmNativeDir FmNativeDir;
+
+/* operations done by the tree walker on each entry; dir_path is used for
+   messages, if it's NULL then name is the full path */
+typedef struct
+{
+    /* reports the error, returns TRUE if user asked to retry */
+    gboolean (*retry)(FmFileOpsJob* job, const char* dir_path, const char* name,
+                      int errsv);
+    /* processes entry which is not a folder, returns FALSE on failure */
+    gboolean (*file)(FmNativeWalker* walker, int dfd, const char* name,
+                     const char* dir_path, const struct stat* st);
+    /* processes folder before its content, returns TRUE if leave() should
+       be called for it after the content */
+    gboolean (*enter)(FmNativeWalker* walker, int dfd, const char* name,
+                      const char* dir_path, const struct stat* st);
+    /* processes folder after its content, content_ok is FALSE if something
+       inside has failed; returns FALSE on failure */
+    gboolean (*leave)(FmNativeWalker* walker, int dfd, const char* name,
+                      const char* dir_path, const struct stat* st,
+                      gboolean content_ok);
+    /* st passed to file() and enter() is NULL unless this is set */
+    gboolean need_stat;
+} FmNativeWalkerFuncs;
+
+/* walks trees of local folders, subfolders are given to idle threads of
+   the pool as soon as they are found */
+struct _FmNativeWalker
+{
+    FmFileOpsJob* job;
+    const FmNativeWalkerFuncs* funcs;
+    GThreadPool* pool;
+    guint n_workers;
+    GAsyncQueue* done; /* receives results of top level folders */
+};
+
+/* directory which content is processed by one or more tasks; the last one
+   which finishes leaves the directory itself and then unrefs parent */
+struct _FmNativeDir
+{
+    FmNativeWalker* walker;
+    FmNativeDir* parent;
+    int dfd; /* parent folder, AT_FDCWD for the top level folder */
+    char* name; /* name relative to dfd */
+    char* path; /* full path, only for messages */
+    struct stat st;
+    gboolean leave; /* leave() should be called for it */
+    volatile gint pending; /* number of tasks working inside */
+    volatile gint failed;
+};
+
+#if defined(HAVE_NATIVE_DELETE) || defined(HAVE_NATIVE_CHANGE_ATTR)
+/* only one error should be shown at a time */
+G_LOCK_DEFINE_STATIC(error);
+
+static guint native_n_workers(void)
+{
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    return CLAMP(g_get_num_processors(), 2, NATIVE_MAX_WORKERS);
+#else
+    return 4;
+#endif
+}
+
+/* reports the error, returns TRUE if user asked to retry */
+static gboolean native_retry(FmFileOpsJob* job, const char* format,
+                             const char* dir_path, const char* name, int errsv,
+                             FmJobErrorSeverity severity)
+{
+    GError* err;
+    char* path;
+    char* disp;
+    FmJobErrorAction act;
+
+    if(fm_job_is_cancelled(FM_JOB(job)))
+        return FALSE;
+    path = dir_path ? g_build_filename(dir_path, name, NULL) : g_strdup(name);
+    disp = g_filename_display_name(path);
+    g_free(path);
+    err = g_error_new(G_IO_ERROR, g_io_error_from_errno(errsv),
+                      format, disp, g_strerror(errsv));
+    g_free(disp);
+    G_LOCK(error);
+    act = fm_job_emit_error(FM_JOB(job), err, severity);
+    G_UNLOCK(error);
+    g_error_free(err);
+    return (act == FM_JOB_RETRY);
+}
+
+/* adds processed entries to the job progress once enough of them gathered */
+static void native_progress(FmFileOpsJob* job, guint* n, const char* dir_path,
+                            gboolean force)
+{
+    if(*n == 0 || (!force && *n < NATIVE_PROGRESS_BATCH))
+        return;
+    _fm_file_ops_job_add_progress(job, *n, 0, *n);
+    *n = 0;
+    if(dir_path)
+    {
+        char* disp = g_filename_display_basename(dir_path);
+        fm_file_ops_job_emit_cur_file(job, disp);
+        g_free(disp);
+    }
+    fm_file_ops_job_emit_percent(job);
+}
+
+static int native_open_dir(FmNativeWalker* walker, int dfd, const char* name,
+                           const char* path)
+{
+    int fd;
+
+    while((fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0)
+    {
+        int errsv = errno;
+        if(errsv != EINTR && !walker->funcs->retry(walker->job, NULL, path, errsv))
+            break;
+    }
+    return fd;
+}
+
+/* creates node for folder name in parent folder dfd, takes ownership of
+   dfd and path */
+static FmNativeDir* native_dir_new(FmNativeWalker* walker, FmNativeDir* parent,
+                                   int dfd, const char* name, char* path,
+                                   const struct stat* st, gboolean leave)
+{
+    FmNativeDir* node = g_slice_new(FmNativeDir);
+
+    node->walker = walker;
+    node->parent = parent;
+    node->dfd = dfd;
+    node->name = g_strdup(name);
+    node->path = path;
+    if(st)
+        node->st = *st;
+    else
+        memset(&node->st, 0, sizeof(node->st));
+    node->leave = leave;
+    node->pending = 1;
+    node->failed = 0;
+    return node;
+}
+
+/* calls leave() for the folder if needed and counts it, the top level
+   folder is counted by the caller so n is NULL for it */
+static gboolean native_leave(FmNativeWalker* walker, int dfd, const char* name,
+                             const char* dir_path, const struct stat* st,
+                             gboolean leave, gboolean content_ok, guint* n)
+{
+    if(fm_job_is_cancelled(FM_JOB(walker->job)))
+        return FALSE;
+    if(leave && !walker->funcs->leave(walker, dfd, name, dir_path, st, content_ok))
+        return FALSE;
+    if(n)
+        ++*n;
+    return content_ok;
+}
+
+/* processes content of directory opened as dfd (which is closed then); if
+   node isn't NULL then subdirectories may be given to other workers */
+static gboolean native_walk_dir(FmNativeWalker* walker, int dfd,
+                                const char* path, FmNativeDir* node, guint* n)
+{
+    const FmNativeWalkerFuncs* funcs = walker->funcs;
+    FmFileOpsJob* job = walker->job;
+    DIR* dir;
+    struct dirent* de;
+    struct stat st;
+    const struct stat* stp = funcs->need_stat ? &st : NULL;
+    gboolean ret = TRUE;
+
+    dir = fdopendir(dfd);
+    if(!dir)
+    {
+        int errsv = errno;
+        close(dfd);
+        funcs->retry(job, NULL, path, errsv);
+        return FALSE;
+    }
+    while(!fm_job_is_cancelled(FM_JOB(job)) && (de = readdir(dir)) != NULL)
+    {
+        const char* name = de->d_name;
+        gboolean is_dir;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if(!funcs->need_stat && de->d_type != DT_UNKNOWN)
+            is_dir = (de->d_type == DT_DIR);
+        else
+#endif
+        if(fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+        else if(funcs->need_stat)
+        {
+            if(errno != ENOENT)
+                funcs->retry(job, path, name, errno);
+            continue;
+        }
+        else /* file() will report the error */
+            is_dir = FALSE;
+        if(is_dir)
+        {
+            char* sub_path = g_build_filename(path, name, NULL);
+            gboolean leave = funcs->enter(walker, dirfd(dir), name, path, stp);
+            int sub_dfd;
+
+            /* split the work only while there are idle workers; the worker
+               gets own copy of this folder fd so it never resolves the path
+               again, which may lead outside the tree if some parent folder
+               was replaced with a symlink meanwhile */
+            if(node && walker->pool &&
+               g_thread_pool_unprocessed(walker->pool) < walker->n_workers &&
+               (sub_dfd = dup(dirfd(dir))) >= 0)
+            {
+                g_atomic_int_inc(&node->pending);
+                g_thread_pool_push(walker->pool,
+                                   native_dir_new(walker, node, sub_dfd, name,
+                                                  sub_path, stp, leave),
+                                   NULL);
+            }
+            else
+            {
+                int sub_fd = native_open_dir(walker, dirfd(dir), name, sub_path);
+                gboolean ok = (sub_fd >= 0 &&
+                               native_walk_dir(walker, sub_fd, sub_path, NULL, n));
+                if(!native_leave(walker, dirfd(dir), name, path, stp, leave, ok, n))
+                    ret = FALSE;
+                g_free(sub_path);
+            }
+        }
+        else if(funcs->file(walker, dirfd(dir), name, path, stp))
+            ++*n;
+        else
+            ret = FALSE;
+        native_progress(job, n, path, FALSE);
+    }
+    closedir(dir);
+    return ret && !fm_job_is_cancelled(FM_JOB(job));
+}
+
+/* drops the reference on node taken by finished task, the last one leaves
+   the directory and goes up the tree */
+static void native_dir_unref(FmNativeDir* node, guint* n)
+{
+    while(node && g_atomic_int_dec_and_test(&node->pending))
+    {
+        FmNativeDir* parent = node->parent;
+        FmNativeWalker* walker = node->walker;
+        gboolean failed = g_atomic_int_get(&node->failed);
+        char* dir_path = NULL;
+
+        /* name of the top level folder is the full path if it has no dfd */
+        if(parent)
+            dir_path = g_strdup(parent->path);
+        else if(node->dfd != AT_FDCWD)
+            dir_path = g_path_get_dirname(node->path);
+        failed = !native_leave(walker, node->dfd, node->name, dir_path, &node->st,
+                               node->leave, !failed, parent ? n : NULL);
+        g_free(dir_path);
+        if(parent)
+        {
+            if(failed)
+                g_atomic_int_set(&parent->failed, 1);
+        }
+        else /* the top level folder is done */
+            g_async_queue_push(walker->done, GINT_TO_POINTER(failed ? 1 : 2));
+        if(node->dfd != AT_FDCWD)
+            close(node->dfd);
+        g_free(node->name);
+        g_free(node->path);
+        g_slice_free(FmNativeDir, node);
+        node = parent;
+    }
+}
+
+/* this is called from a thread of the pool or from the job thread */
+static void native_walk_task_run(gpointer data, gpointer user_data)
+{
+    FmNativeDir* node = (FmNativeDir*)data;
+    FmNativeWalker* walker = (FmNativeWalker*)user_data;
+    FmFileOpsJob* job = walker->job;
+    guint n = 0;
+    int fd;
+
+    if(!fm_job_is_cancelled(FM_JOB(job)))
+    {
+        fd = native_open_dir(walker, node->dfd, node->name, node->path);
+        if(fd < 0 || !native_walk_dir(walker, fd, node->path, node, &n))
+            g_atomic_int_set(&node->failed, 1);
+        native_progress(job, &n, node->path, TRUE);
+    }
+    else
+        g_atomic_int_set(&node->failed, 1);
+    native_dir_unref(node, &n);
+    native_progress(job, &n, NULL, TRUE);
+}
+
+static void native_walker_init(FmNativeWalker* walker, FmFileOpsJob* job,
+                               const FmNativeWalkerFuncs* funcs)
+{
+    walker->job = job;
+    walker->funcs = funcs;
+    walker->n_workers = native_n_workers();
+    walker->pool = g_thread_pool_new(native_walk_task_run, walker,
+                                     walker->n_workers, FALSE, NULL);
+    walker->done = g_async_queue_new();
+}
+
+/* processes content of the folder name in parent folder dfd and waits for
+   the workers; dfd (which may be AT_FDCWD, then name is the full path) and
+   path are freed then. enter() for the folder itself should be called by
+   the caller and leave() is called only if leave is TRUE */
+static gboolean native_walk(FmNativeWalker* walker, int dfd, const char* name,
+                            char* path, const struct stat* st, gboolean leave)
+{
+    /* the top level folder is handled by the job thread itself, the rest
+       is split among the pool as soon as subfolders are found */
+    native_walk_task_run(native_dir_new(walker, NULL, dfd, name, path, st, leave),
+                         walker);
+    /* wait till all subtrees are done */
+    return (GPOINTER_TO_INT(g_async_queue_pop(walker->done)) == 2);
+}
+
+static void native_walker_destroy(FmNativeWalker* walker)
+{
+    if(walker->pool)
+        g_thread_pool_free(walker->pool, FALSE, TRUE);
+    g_async_queue_unref(walker->done);
+}
+#endif
+
+/* ---- recursive delete ---- */
+
+struct _FmDeleteEngine
+{
+    FmNativeWalker walker;
+};
+
+#ifdef HAVE_NATIVE_DELETE
+static gboolean delete_retry(FmFileOpsJob* job, const char* dir_path,
+                             const char* name, int errsv)
+{
+    return native_retry(job, _("Cannot remove '%s': %s"), dir_path, name, errsv,
+                        FM_JOB_ERROR_MODERATE);
+}
+
+/* removes single entry; dir_path is used for messages, if it's NULL then
+   name should be the full path */
+static gboolean delete_entry(FmFileOpsJob* job, int dfd, const char* name,
+                             int flags, const char* dir_path)
+{
+    while(unlinkat(dfd, name, flags) < 0)
+    {
+        if(errno == ENOENT) /* someone did it already */
+            break;
+        if(!delete_retry(job, dir_path, name, errno))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean delete_file(FmNativeWalker* walker, int dfd, const char* name,
+                            const char* dir_path, const struct stat* st)
+{
+    return delete_entry(walker->job, dfd, name, 0, dir_path);
+}
+
+static gboolean delete_enter(FmNativeWalker* walker, int dfd, const char* name,
+                             const char* dir_path, const struct stat* st)
+{
+    /* the folder is removed after its content */
+    return TRUE;
+}
+
+static gboolean delete_leave(FmNativeWalker* walker, int dfd, const char* name,
+                             const char* dir_path, const struct stat* st,
+                             gboolean content_ok)
+{
+    return content_ok &&
+           delete_entry(walker->job, dfd, name, AT_REMOVEDIR, dir_path);
+}
+
+static const FmNativeWalkerFuncs delete_funcs =
+{
+    delete_retry,
+    delete_file,
+    delete_enter,
+    delete_leave,
+    FALSE /* d_type is enough */
+};
+
+/* removes folder at path (which is freed then) with all its content, or
+   only the content if keep is TRUE */
+static gboolean delete_tree(FmDeleteEngine* engine, char* path, gboolean keep)
+{
+    guint n = 1;
+
+    if(!native_walk(&engine->walker, AT_FDCWD, path, path, NULL, !keep))
+        return FALSE;
+    if(!keep)
+        native_progress(engine->walker.job, &n, NULL, TRUE);
+    return TRUE;
+}
+
+/* removes content of the folder name in the trash can */
+static gboolean empty_trash_folder(FmDeleteEngine* engine, const char* trash,
+                                   const char* name)
+{
+    char* path = g_build_filename(trash, name, NULL);
+    struct stat st;
+
+    if(lstat(path, &st) < 0) /* nothing to empty */
+    {
+        g_free(path);
+        return TRUE;
+    }
+    return delete_tree(engine, path, TRUE);
+}
+#endif /* HAVE_NATIVE_DELETE */
+
+/*
+ * _fm_file_ops_job_delete_native_new
+ * @job: the job to delete files for
+ *
+ * Creates engine to remove local files and folders without GIO, using
+ * unlinkat() relative to the opened folder. Subfolders are removed by
+ * several threads at once if possible.
+ *
+ * Returns: new engine or %NULL if the system doesn't support it.
+ */
+FmDeleteEngine* _fm_file_ops_job_delete_native_new(FmFileOpsJob* job)
+{
+#ifdef HAVE_NATIVE_DELETE
+    FmDeleteEngine* engine = g_slice_new(FmDeleteEngine);
+
+    native_walker_init(&engine->walker, job, &delete_funcs);
+    return engine;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_delete_native
+ * @engine: the engine
+ * @gf: local file or folder to remove
+ *
+ * Removes @gf recursively. Progress of the job is updated in batches and
+ * errors are reported via the job.
+ *
+ * Returns: %TRUE if @gf was removed.
+ */
+gboolean _fm_file_ops_job_delete_native(FmDeleteEngine* engine, GFile* gf)
+{
+#ifdef HAVE_NATIVE_DELETE
+    FmFileOpsJob* job = engine->walker.job;
+    char* path = g_file_get_path(gf);
+    char* disp;
+    struct stat st;
+    guint n = 0;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+    /* currently processed file. */
+    disp = g_filename_display_basename(path);
+    fm_file_ops_job_emit_cur_file(job, disp);
+    g_free(disp);
+    while(lstat(path, &st) < 0)
+    {
+        if(!delete_retry(job, NULL, path, errno))
+        {
+            g_free(path);
+            return FALSE;
+        }
+    }
+    if(!S_ISDIR(st.st_mode))
+    {
+        gboolean ret = delete_entry(job, AT_FDCWD, path, 0, NULL);
+        n = 1;
+        native_progress(job, &n, NULL, TRUE);
+        g_free(path);
+        return ret;
+    }
+    return delete_tree(engine, path, FALSE);
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_empty_trash_native
+ * @engine: the engine
+ *
+ * Removes everything from local trash cans of the user: content of files
+ * folder of each trash can first and then content of its info folder so
+ * interrupted operation never leaves files without info.
+ *
+ * Returns: %TRUE if all trash cans were emptied.
+ */
+gboolean _fm_file_ops_job_empty_trash_native(FmDeleteEngine* engine)
+{
+#ifdef HAVE_NATIVE_DELETE
+    FmFileOpsJob* job = engine->walker.job;
+    GSList *dirs, *l;
+    gboolean ret = TRUE;
+    char* path;
+
+    dirs = fm_trash_list_dirs();
+    for(l = dirs; l; l = l->next)
+    {
+        if(!fm_job_is_cancelled(FM_JOB(job)))
+        {
+            /* info is kept if some files were left */
+            if(!empty_trash_folder(engine, l->data, "files") ||
+               !empty_trash_folder(engine, l->data, "info"))
+                ret = FALSE;
+            /* cached sizes of trashed folders aren't valid anymore */
+            path = g_build_filename(l->data, "directorysizes", NULL);
+            unlink(path);
+            g_free(path);
+        }
+        g_free(l->data);
+    }
+    g_slist_free(dirs);
+    return ret;
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_delete_native_free
+ * @engine: the engine
+ *
+ * Waits for the workers and frees @engine.
+ */
+void _fm_file_ops_job_delete_native_free(FmDeleteEngine* engine)
+{
+#ifdef HAVE_NATIVE_DELETE
+    native_walker_destroy(&engine->walker);
+#endif
+    g_slice_free(FmDeleteEngine, engine);
+}
+
+/* ---- recursive change of attributes ---- */
+
+/* what should be changed on the entry */
+#define CHATTR_OWNER 1
+#define CHATTR_MODE 2
+
+struct _FmChangeAttrEngine
+{
+    FmNativeWalker walker;
+    gboolean is_root; /* root can enter folders regardless of mode */
+};
+
+#ifdef HAVE_NATIVE_CHANGE_ATTR
+static gboolean chattr_retry(FmFileOpsJob* job, const char* dir_path,
+                             const char* name, int errsv)
+{
+    return native_retry(job, _("Cannot change attributes of '%s': %s"),
+                        dir_path, name, errsv, FM_JOB_ERROR_MILD);
+}
+
+/* sets owner and/or mode of single entry; dir_path is used for messages,
+   if it's NULL then name should be the full path. Errors are mild, same as
+   for the GIO path, so they never stop the job. */
+static void chattr_entry(FmFileOpsJob* job, int dfd, const char* name,
+                         const char* dir_path, const struct stat* st, int what)
+{
+    gboolean owner = (job->uid != -1 || job->gid != -1);
+    mode_t mode;
+
+    if((what & CHATTR_OWNER) && owner)
+    {
+        while(fchownat(dfd, name, (uid_t)job->uid, (gid_t)job->gid,
+                       AT_SYMLINK_NOFOLLOW) < 0)
+        {
+            if(errno == ENOENT || !chattr_retry(job, dir_path, name, errno))
+                break;
+        }
+    }
+    /* permissions of symlinks cannot be changed on Linux */
+    if((what & CHATTR_MODE) && job->new_mode_mask && !S_ISLNK(st->st_mode))
+    {
+        mode = _fm_file_ops_job_change_attr_mode(job, st->st_mode);
+        /* chown() may reset setuid bits so they should be set again */
+        if(mode == (st->st_mode & 07777) && !owner)
+            return;
+        while(fchmodat(dfd, name, mode, 0) < 0)
+        {
+            if(errno == ENOENT || !chattr_retry(job, dir_path, name, errno))
+                break;
+        }
+    }
+}
+
+static gboolean chattr_file(FmNativeWalker* walker, int dfd, const char* name,
+                            const char* dir_path, const struct stat* st)
+{
+    chattr_entry(walker->job, dfd, name, dir_path, st, CHATTR_OWNER | CHATTR_MODE);
+    return TRUE;
+}
+
+static gboolean chattr_enter(FmNativeWalker* walker, int dfd, const char* name,
+                             const char* dir_path, const struct stat* st)
+{
+    FmChangeAttrEngine* engine = (FmChangeAttrEngine*)walker;
+    FmFileOpsJob* job = walker->job;
+    gboolean early = TRUE;
+
+    /* if the folder becomes inaccessible then change its mode only after
+       its content */
+    if(!engine->is_root && job->new_mode_mask)
+    {
+        mode_t mode = _fm_file_ops_job_change_attr_mode(job, st->st_mode);
+        early = ((mode & (S_IRUSR | S_IXUSR)) == (S_IRUSR | S_IXUSR));
+    }
+    chattr_entry(job, dfd, name, dir_path, st,
+                 early ? (CHATTR_OWNER | CHATTR_MODE) : CHATTR_OWNER);
+    return !early;
+}
+
+static gboolean chattr_leave(FmNativeWalker* walker, int dfd, const char* name,
+                             const char* dir_path, const struct stat* st,
+                             gboolean content_ok)
+{
+    chattr_entry(walker->job, dfd, name, dir_path, st, CHATTR_MODE);
+    return TRUE;
+}
+
+static const FmNativeWalkerFuncs chattr_funcs =
+{
+    chattr_retry,
+    chattr_file,
+    chattr_enter,
+    chattr_leave,
+    TRUE /* current mode is needed anyway so d_type doesn't help */
+};
+#endif /* HAVE_NATIVE_CHANGE_ATTR */
+
+/*
+ * _fm_file_ops_job_change_attr_native_new
+ * @job: the job to change attributes for
+ *
+ * Creates engine to change owner and permissions of local files and
+ * folders recursively without GIO, using fchownat() and fchmodat()
+ * relative to the opened folder. Subfolders are processed by several
+ * threads at once if possible.
+ *
+ * Returns: new engine or %NULL if the system doesn't support it.
+ */
+FmChangeAttrEngine* _fm_file_ops_job_change_attr_native_new(FmFileOpsJob* job)
+{
+#ifdef HAVE_NATIVE_CHANGE_ATTR
+    FmChangeAttrEngine* engine = g_slice_new(FmChangeAttrEngine);
+
+    native_walker_init(&engine->walker, job, &chattr_funcs);
+    engine->is_root = (geteuid() == 0);
+    return engine;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_change_attr_native
+ * @engine: the engine
+ * @gf: local file or folder to change
+ *
+ * Changes owner and permissions of @gf and everything inside it, as set
+ * with fm_file_ops_job_set_chown() and fm_file_ops_job_set_chmod().
+ * Progress of the job is updated in batches and errors are reported via
+ * the job.
+ *
+ * Returns: %FALSE if some folder could not be read.
+ */
+gboolean _fm_file_ops_job_change_attr_native(FmChangeAttrEngine* engine, GFile* gf)
+{
+#ifdef HAVE_NATIVE_CHANGE_ATTR
+    FmFileOpsJob* job = engine->walker.job;
+    char* path = g_file_get_path(gf);
+    char *disp, *dir_path, *name;
+    struct stat st;
+    gboolean leave, ret = TRUE;
+    int dfd;
+    guint n = 1;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+    /* currently processed file. */
+    disp = g_filename_display_basename(path);
+    fm_file_ops_job_emit_cur_file(job, disp);
+    g_free(disp);
+    /* the parent folder is opened once so the mode of the top level folder,
+       which may be set only after the whole tree, is never resolved through
+       the path again */
+    dir_path = g_path_get_dirname(path);
+    name = g_path_get_basename(path);
+    dfd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if(dfd < 0) /* the parent cannot be read, use the path then */
+    {
+        g_free(dir_path);
+        g_free(name);
+        dir_path = NULL;
+        name = g_strdup(path);
+        dfd = AT_FDCWD;
+    }
+    while(fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+    {
+        if(!chattr_retry(job, dir_path, name, errno))
+        {
+            ret = FALSE;
+            break;
+        }
+    }
+    if(ret && !S_ISDIR(st.st_mode))
+    {
+        chattr_file(&engine->walker, dfd, name, dir_path, &st);
+        native_progress(job, &n, NULL, TRUE);
+    }
+    else if(ret)
+    {
+        leave = chattr_enter(&engine->walker, dfd, name, dir_path, &st);
+        native_progress(job, &n, NULL, TRUE);
+        /* dfd and path are freed by the walker */
+        ret = native_walk(&engine->walker, dfd, name, path, &st, leave);
+        dfd = AT_FDCWD;
+        path = NULL;
+    }
+    if(dfd != AT_FDCWD)
+        close(dfd);
+    g_free(path);
+    g_free(dir_path);
+    g_free(name);
+    return ret;
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_change_attr_native_free
+ * @engine: the engine
+ *
+ * Waits for the workers and frees @engine.
+ */
+void _fm_file_ops_job_change_attr_native_free(FmChangeAttrEngine* engine)
+{
+#ifdef HAVE_NATIVE_CHANGE_ATTR
+    native_walker_destroy(&engine->walker);
+#endif
+    g_slice_free(FmChangeAttrEngine, engine);
+}
+
+/* ---- trash ---- */
+
+#ifdef HAVE_RENAMEAT
+# define HAVE_NATIVE_TRASH 1
+#endif
+
+/* trash can for files of one device, see the freedesktop.org Trash spec */
+typedef struct
+{
+    dev_t dev;
+    char* topdir; /* NULL for the home trash */
+    int files_fd; /* -1 if files on the device cannot be trashed */
+    int info_fd;
+} FmTrashDir;
+
+struct _FmTrashEngine
+{
+    FmFileOpsJob* job;
+    GSList* dirs; /* trash cans found so far */
+    time_t date_time;
+    char date[32]; /* DeletionDate for date_time */
+};
+
+#ifdef HAVE_NATIVE_TRASH
+/* creates files and info folders of the trash can at trash_path */
+static gboolean trash_dir_open(FmTrashDir* td, const char* trash_path)
+{
+    char* path;
+    struct stat st;
+
+    /* the trash can should be on the same device, not a link to elsewhere */
+    if(lstat(trash_path, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_dev != td->dev)
+        return FALSE;
+    path = g_build_filename(trash_path, "files", NULL);
+    mkdir(path, 0700);
+    td->files_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    g_free(path);
+    path = g_build_filename(trash_path, "info", NULL);
+    mkdir(path, 0700);
+    td->info_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    g_free(path);
+    if(td->files_fd >= 0 && td->info_fd >= 0)
+        return TRUE;
+    if(td->files_fd >= 0)
+        close(td->files_fd);
+    if(td->info_fd >= 0)
+        close(td->info_fd);
+    td->files_fd = td->info_fd = -1;
+    return FALSE;
+}
+
+/* finds mount point of the device dev which contains folder dir */
+static char* trash_find_topdir(const char* dir, dev_t dev)
+{
+    char* topdir = g_strdup(dir);
+    char* parent;
+    struct stat st;
+
+    while(strcmp(topdir, "/") != 0)
+    {
+        parent = g_path_get_dirname(topdir);
+        if(lstat(parent, &st) < 0 || st.st_dev != dev)
+        {
+            g_free(parent);
+            break;
+        }
+        g_free(topdir);
+        topdir = parent;
+    }
+    return topdir;
+}
+
+/* looks for trash can on the device where folder dir is, which should be
+   a real path, creates it if needed; the result is cached by device.
+   Returns NULL if dir is on another device, i.e. the file is mount point. */
+static FmTrashDir* trash_get_dir(FmTrashEngine* engine, const char* dir, dev_t dev)
+{
+    FmTrashDir* td;
+    GSList* l;
+    struct stat st;
+    char *path, *sub;
+    uid_t uid = getuid();
+
+    for(l = engine->dirs; l; l = l->next)
+        if(((FmTrashDir*)l->data)->dev == dev)
+            return (FmTrashDir*)l->data;
+    if(lstat(dir, &st) < 0 || st.st_dev != dev)
+        return NULL;
+    td = g_slice_new(FmTrashDir);
+    td->dev = dev;
+    td->topdir = NULL;
+    td->files_fd = td->info_fd = -1;
+    engine->dirs = g_slist_prepend(engine->dirs, td);
+
+    /* the home trash is used for files on the same device */
+    path = g_build_filename(g_get_user_data_dir(), "Trash", NULL);
+    g_mkdir_with_parents(path, 0700);
+    if(stat(path, &st) == 0 && st.st_dev == dev)
+    {
+        trash_dir_open(td, path);
+        g_free(path);
+        return td;
+    }
+    g_free(path);
+
+    td->topdir = trash_find_topdir(dir, dev);
+    /* $topdir/.Trash/$uid if administrator created $topdir/.Trash */
+    path = g_build_filename(td->topdir, ".Trash", NULL);
+    if(lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && (st.st_mode & S_ISVTX))
+    {
+        sub = g_strdup_printf("%s/%u", path, (guint)uid);
+        mkdir(sub, 0700);
+        if(lstat(sub, &st) == 0 && st.st_uid == uid && trash_dir_open(td, sub))
+        {
+            g_free(sub);
+            g_free(path);
+            return td;
+        }
+        g_free(sub);
+    }
+    g_free(path);
+    /* otherwise $topdir/.Trash-$uid */
+    path = g_strdup_printf("%s/.Trash-%u", strcmp(td->topdir, "/") ? td->topdir : "",
+                           (guint)uid);
+    mkdir(path, 0700);
+    if(lstat(path, &st) == 0 && st.st_uid == uid)
+        trash_dir_open(td, path);
+    g_free(path);
+    return td;
+}
+#endif /* HAVE_NATIVE_TRASH */
+
+/*
+ * _fm_file_ops_job_trash_native_new
+ * @job: the job to trash files for
+ *
+ * Creates engine to move local files into trash cans as described by the
+ * freedesktop.org Trash specification, without GIO. Trash can for each
+ * device is found only once for all the files.
+ *
+ * Returns: new engine or %NULL if the system doesn't support it.
+ */
+FmTrashEngine* _fm_file_ops_job_trash_native_new(FmFileOpsJob* job)
+{
+#ifdef HAVE_NATIVE_TRASH
+    FmTrashEngine* engine = g_slice_new0(FmTrashEngine);
+
+    engine->job = job;
+    return engine;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * _fm_file_ops_job_trash_native
+ * @engine: the engine
+ * @gf: local file or folder to trash
+ * @error: location to store error
+ *
+ * Moves @gf into the trash can and writes its .trashinfo file.
+ *
+ * Returns: %TRUE if @gf was trashed. Fails with %G_IO_ERROR_NOT_SUPPORTED
+ * if there is no trash can for @gf, so g_file_trash() may be tried.
+ */
+gboolean _fm_file_ops_job_trash_native(FmTrashEngine* engine, GFile* gf, GError** error)
+{
+#ifdef HAVE_NATIVE_TRASH
+    char *path, *dir, *real_dir, *basename, *orig, *escaped, *content;
+    char *name = NULL, *info_name = NULL;
+    FmTrashDir* td;
+    struct stat st;
+    time_t now;
+    gboolean ret = FALSE;
+    int i, fd, errsv;
+
+    path = g_file_get_path(gf);
+    if(!path)
+        goto _not_supported;
+    if(lstat(path, &st) < 0)
+    {
+        set_error_from_errno(error, errno);
+        g_free(path);
+        return FALSE;
+    }
+    /* parent folder may be given via symlink */
+    dir = g_path_get_dirname(path);
+    real_dir = realpath(dir, NULL);
+    g_free(dir);
+    if(!real_dir)
+    {
+        g_free(path);
+        goto _not_supported;
+    }
+    td = trash_get_dir(engine, real_dir, st.st_dev);
+    if(!td || td->files_fd < 0)
+    {
+        free(real_dir);
+        g_free(path);
+        goto _not_supported;
+    }
+    basename = g_path_get_basename(path);
+    orig = g_build_filename(real_dir, basename, NULL);
+    free(real_dir);
+    if(td->topdir) /* path relative to the top directory */
+    {
+        gsize len = strlen(td->topdir);
+        if(strcmp(td->topdir, "/") == 0)
+            len = 0;
+        else if(strncmp(orig, td->topdir, len) != 0 || orig[len] != '/')
+        {
+            g_free(orig);
+            g_free(basename);
+            g_free(path);
+            goto _not_supported;
+        }
+        escaped = g_uri_escape_string(orig + len + 1, "/", FALSE);
+    }
+    else
+        escaped = g_uri_escape_string(orig, "/", FALSE);
+    g_free(orig);
+    now = time(NULL);
+    if(now != engine->date_time)
+    {
+        struct tm tm;
+
+        engine->date_time = now;
+        /* localtime() uses static buffer shared with other threads */
+        localtime_r(&now, &tm);
+        strftime(engine->date, sizeof(engine->date), "%Y-%m-%dT%H:%M:%S", &tm);
+    }
+    content = g_strdup_printf("[Trash Info]\nPath=%s\nDeletionDate=%s\n",
+                              escaped, engine->date);
+    g_free(escaped);
+
+    /* creating the info file reserves the name in the trash can */
+    for(i = 1; ; i++)
+    {
+        name = (i == 1) ? g_strdup(basename) : g_strdup_printf("%s.%d", basename, i);
+        info_name = g_strconcat(name, ".trashinfo", NULL);
+        fd = openat(td->info_fd, info_name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+        if(fd >= 0)
+        {
+            /* leftover of broken trashing, don't overwrite it */
+            if(fstatat(td->files_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                break;
+            close(fd);
+            unlinkat(td->info_fd, info_name, 0);
+        }
+        else if(errno != EEXIST)
+        {
+            set_error_from_errno(error, errno);
+            goto _out;
+        }
+        g_free(name);
+        g_free(info_name);
+    }
+    if(!write_all(fd, content, strlen(content), error))
+    {
+        close(fd);
+        unlinkat(td->info_fd, info_name, 0);
+        goto _out;
+    }
+    close(fd);
+    if(renameat(AT_FDCWD, path, td->files_fd, name) < 0)
+    {
+        errsv = errno;
+        unlinkat(td->info_fd, info_name, 0);
+        /* bind mounts have the same device but cannot be renamed across */
+        if(errsv == EXDEV)
+            g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                g_strerror(errsv));
+        else
+            set_error_from_errno(error, errsv);
+        goto _out;
+    }
+    ret = TRUE;
+
+_out:
+    g_free(name);
+    g_free(info_name);
+    g_free(content);
+    g_free(basename);
+    g_free(path);
+    return ret;
+
+_not_supported:
+#endif
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        g_strerror(ENOTSUP));
+    return FALSE;
+}
+
+/*
+ * _fm_file_ops_job_trash_native_free
+ * @engine: the engine
+ *
+ * Frees @engine and closes trash cans.
+ */
+void _fm_file_ops_job_trash_native_free(FmTrashEngine* engine)
+{
+    GSList* l;
+
+    for(l = engine->dirs; l; l = l->next)
+    {
+        FmTrashDir* td = (FmTrashDir*)l->data;
+        if(td->files_fd >= 0)
+            close(td->files_fd);
+        if(td->info_fd >= 0)
+            close(td->info_fd);
+        g_free(td->topdir);
+        g_slice_free(FmTrashDir, td);
+    }
+    g_slist_free(engine->dirs);
+    g_slice_free(FmTrashEngine, engine);
+}
@@ -0,0 +1,62 @@
+/*
+ *      fm-file-ops-job-native.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_FILE_OPS_JOB_NATIVE_H__
+#define __FM_FILE_OPS_JOB_NATIVE_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "fm-file-ops-job.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FmDeleteEngine FmDeleteEngine;
+typedef struct _FmChangeAttrEngine FmChangeAttrEngine;
+typedef struct _FmTrashEngine FmTrashEngine;
+
+/* copies regular file between two local paths using the kernel facilities;
+   fails with G_IO_ERROR_NOT_SUPPORTED if g_file_copy() should be used instead */
+gboolean _fm_file_ops_job_copy_native(FmFileOpsJob* job, GFile* src, GFile* dest,
+                                      GFileCopyFlags flags,
+                                      GFileProgressCallback progress,
+                                      gpointer progress_data, GError** error);
+
+gboolean _fm_file_ops_job_rename_native(const char* src_path, const char* dest_path);
+
+/* removes local files recursively with many threads */
+FmDeleteEngine* _fm_file_ops_job_delete_native_new(FmFileOpsJob* job);
+gboolean _fm_file_ops_job_delete_native(FmDeleteEngine* engine, GFile* gf);
+gboolean _fm_file_ops_job_empty_trash_native(FmDeleteEngine* engine);
+void _fm_file_ops_job_delete_native_free(FmDeleteEngine* engine);
+
+/* changes owner and mode of local files recursively with many threads */
+FmChangeAttrEngine* _fm_file_ops_job_change_attr_native_new(FmFileOpsJob* job);
+gboolean _fm_file_ops_job_change_attr_native(FmChangeAttrEngine* engine, GFile* gf);
+void _fm_file_ops_job_change_attr_native_free(FmChangeAttrEngine* engine);
+
+/* moves local files into the freedesktop.org trash */
+FmTrashEngine* _fm_file_ops_job_trash_native_new(FmFileOpsJob* job);
+gboolean _fm_file_ops_job_trash_native(FmTrashEngine* engine, GFile* gf, GError** error);
+void _fm_file_ops_job_trash_native_free(FmTrashEngine* engine);
+
+G_END_DECLS
+
+#endif
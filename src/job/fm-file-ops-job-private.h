@@ -0,0 +1,43 @@
+/*
+ *      fm-file-ops-job-private.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_FILE_OPS_JOB_PRIVATE_H__
+#define __FM_FILE_OPS_JOB_PRIVATE_H__
+
+#include <glib.h>
+#include "fm-file-ops-job.h"
+#include "fm-deep-count-job.h"
+
+G_BEGIN_DECLS
+
+/* counters are sampled by the main thread so only these should change them */
+void _fm_file_ops_job_add_progress(FmFileOpsJob* job, goffset finished, goffset current,
+                                   guint n_files);
+void _fm_file_ops_job_set_total(FmFileOpsJob* job, goffset total);
+
+/* deep count running concurrently with the job */
+void _fm_file_ops_job_start_count(FmFileOpsJob* job, FmDeepCountJob* dc, gboolean by_count);
+void _fm_file_ops_job_finish_count(FmFileOpsJob* job);
+gboolean _fm_file_ops_job_check_space(FmFileOpsJob* job);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ *      fm-file-ops-job-stream.c
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* GVFS backends handle one request of a stream at a time, so with
+ * g_file_copy() every read from the source waits for the previous write
+ * to the destination and vice versa, and throughput drops as latency of
+ * the network grows. Here the source is read by a separate thread into
+ * a ring of large chunks while the calling thread writes them out. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fm-file-ops-job-stream.h"
+#include <errno.h>
+#include <string.h>
+
+/* files smaller than that are left to g_file_copy() */
+#define STREAM_MIN_SIZE (1024 * 1024)
+/* size of a chunk and number of chunks in the ring */
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+#define STREAM_CHUNKS 8
+
+typedef struct
+{
+    guchar* data;
+    gssize len; /* 0 for EOF, -1 for error */
+} FmStreamChunk;
+
+typedef struct
+{
+    GFile* src;
+    GCancellable* cancellable; /* cancelled with the job or on write error */
+    GAsyncQueue* free_chunks;
+    GAsyncQueue* full_chunks;
+    GError* error; /* error of the reader */
+} FmStreamPipe;
+
+static void on_job_cancelled(GCancellable* cancellable, GCancellable* pipe_cancellable)
+{
+    g_cancellable_cancel(pipe_cancellable);
+}
+
+static gpointer stream_reader(gpointer data)
+{
+    FmStreamPipe* pipe = (FmStreamPipe*)data;
+    GFileInputStream* in;
+    FmStreamChunk* chunk;
+    gsize n;
+
+    in = g_file_read(pipe->src, pipe->cancellable, &pipe->error);
+    for(;;)
+    {
+        chunk = (FmStreamChunk*)g_async_queue_pop(pipe->free_chunks);
+        if(!in || !g_input_stream_read_all(G_INPUT_STREAM(in), chunk->data,
+                                           STREAM_CHUNK_SIZE, &n,
+                                           pipe->cancellable, &pipe->error))
+        {
+            chunk->len = -1;
+            g_async_queue_push(pipe->full_chunks, chunk);
+            break;
+        }
+        chunk->len = n;
+        g_async_queue_push(pipe->full_chunks, chunk);
+        if(n == 0) /* EOF reached */
+            break;
+    }
+    if(in)
+    {
+        g_input_stream_close(G_INPUT_STREAM(in), NULL, NULL);
+        g_object_unref(in);
+    }
+    return NULL;
+}
+
+/*
+ * _fm_file_ops_job_copy_stream
+ * @job: the job
+ * @src: source file
+ * @dest: destination file
+ * @flags: flags for copying
+ * @progress: callback to report progress
+ * @progress_data: data for @progress
+ * @error: location to store error
+ *
+ * Copies regular file overlapping reads from @src with writes to @dest.
+ * This is intended for files on the remote filesystems where latency of
+ * each request is high. Existing @dest is only replaced if @flags has
+ * %G_FILE_COPY_OVERWRITE, otherwise it fails with %G_IO_ERROR_EXISTS.
+ *
+ * Returns: %TRUE if file was copied. Fails with %G_IO_ERROR_NOT_SUPPORTED
+ * if g_file_copy() should be used instead.
+ */
+gboolean _fm_file_ops_job_copy_stream(FmFileOpsJob* job, GFile* src, GFile* dest,
+                                      GFileCopyFlags flags,
+                                      GFileProgressCallback progress,
+                                      gpointer progress_data, GError** error)
+{
+    GCancellable* cancellable = fm_job_get_cancellable(FM_JOB(job));
+    FmStreamPipe pipe;
+    FmStreamChunk* chunk;
+    GFileInfo* inf;
+    GFileOutputStream* out;
+    GThread* reader;
+    goffset size, offset = 0;
+    gulong handler;
+    gboolean ret;
+    int i;
+
+    inf = g_file_query_info(src, G_FILE_ATTRIBUTE_STANDARD_TYPE","
+                                 G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, NULL);
+    if(!inf)
+        goto _not_supported;
+    /* symlinks, special files and small files are handled well by GIO */
+    size = g_file_info_get_size(inf);
+    ret = (g_file_info_get_file_type(inf) == G_FILE_TYPE_REGULAR &&
+           size >= STREAM_MIN_SIZE);
+    g_object_unref(inf);
+    if(!ret)
+        goto _not_supported;
+
+    pipe.src = src;
+    pipe.error = NULL;
+    pipe.cancellable = g_cancellable_new();
+    pipe.free_chunks = g_async_queue_new();
+    pipe.full_chunks = g_async_queue_new();
+    for(i = 0; i < STREAM_CHUNKS; i++)
+    {
+        chunk = g_slice_new(FmStreamChunk);
+        chunk->data = g_malloc(STREAM_CHUNK_SIZE);
+        g_async_queue_push(pipe.free_chunks, chunk);
+    }
+    handler = g_cancellable_connect(cancellable, G_CALLBACK(on_job_cancelled),
+                                    pipe.cancellable, NULL);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    reader = g_thread_try_new("copy reader", stream_reader, &pipe, NULL);
+#else
+    reader = g_thread_create(stream_reader, &pipe, TRUE, NULL);
+#endif
+    if(!reader)
+    {
+        ret = FALSE;
+        goto _free_pipe;
+    }
+
+    /* opening the destination goes in parallel with opening the source */
+    if(flags & G_FILE_COPY_OVERWRITE)
+        out = g_file_replace(dest, NULL, (flags & G_FILE_COPY_BACKUP) != 0,
+                             G_FILE_CREATE_REPLACE_DESTINATION, cancellable, error);
+    else
+        out = g_file_create(dest, G_FILE_CREATE_NONE, cancellable, error);
+    ret = (out != NULL);
+    if(!ret)
+        g_cancellable_cancel(pipe.cancellable);
+    for(;;)
+    {
+        chunk = (FmStreamChunk*)g_async_queue_pop(pipe.full_chunks);
+        if(chunk->len <= 0)
+        {
+            if(chunk->len < 0 && ret) /* read failed */
+            {
+                g_propagate_error(error, pipe.error);
+                pipe.error = NULL;
+                ret = FALSE;
+            }
+            g_async_queue_push(pipe.free_chunks, chunk);
+            break;
+        }
+        /* after an error just return chunks to the reader until it stops */
+        if(ret)
+        {
+            if(g_output_stream_write_all(G_OUTPUT_STREAM(out), chunk->data,
+                                         chunk->len, NULL, cancellable, error))
+            {
+                offset += chunk->len;
+                if(progress)
+                    progress(offset, MAX(offset, size), progress_data);
+            }
+            else
+            {
+                ret = FALSE;
+                g_cancellable_cancel(pipe.cancellable);
+            }
+        }
+        g_async_queue_push(pipe.free_chunks, chunk);
+    }
+    g_thread_join(reader);
+
+    if(out)
+    {
+        /* closing with cancelled cancellable drops replacement of the file */
+        if(ret)
+            ret = g_output_stream_close(G_OUTPUT_STREAM(out), cancellable, error);
+        else
+        {
+            g_cancellable_cancel(pipe.cancellable);
+            g_output_stream_close(G_OUTPUT_STREAM(out), pipe.cancellable, NULL);
+        }
+        g_object_unref(out);
+        /* don't leave partial file which was created by us */
+        if(!ret && !(flags & G_FILE_COPY_OVERWRITE))
+            g_file_delete(dest, NULL, NULL);
+    }
+    /* failure to copy metadata is not a hard error, same as in GIO */
+    if(ret)
+        g_file_copy_attributes(src, dest, flags, cancellable, NULL);
+
+_free_pipe:
+    g_cancellable_disconnect(cancellable, handler);
+    for(i = 0; i < STREAM_CHUNKS; i++)
+    {
+        chunk = (FmStreamChunk*)g_async_queue_pop(pipe.free_chunks);
+        g_free(chunk->data);
+        g_slice_free(FmStreamChunk, chunk);
+    }
+    g_async_queue_unref(pipe.free_chunks);
+    g_async_queue_unref(pipe.full_chunks);
+    g_object_unref(pipe.cancellable);
+    if(pipe.error)
+        g_error_free(pipe.error);
+    if(reader)
+        return ret;
+
+_not_supported:
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        g_strerror(ENOTSUP));
+    return FALSE;
+}
@@ -0,0 +1,41 @@
+/*
+ *      fm-file-ops-job-stream.h
+ *
+ *      This file is a part of the Libfm project.
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FM_FILE_OPS_JOB_STREAM_H__
+#define __FM_FILE_OPS_JOB_STREAM_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "fm-file-ops-job.h"
+
+G_BEGIN_DECLS
+
+/* copies regular file reading and writing it in separate threads, for the
+   remote filesystems; fails with G_IO_ERROR_NOT_SUPPORTED if g_file_copy()
+   should be used instead */
+gboolean _fm_file_ops_job_copy_stream(FmFileOpsJob* job, GFile* src, GFile* dest,
+                                      GFileCopyFlags flags,
+                                      GFileProgressCallback progress,
+                                      gpointer progress_data, GError** error);
+
+G_END_DECLS
+
+#endif
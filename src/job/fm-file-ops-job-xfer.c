@@ -24,7 +24,11 @@
 #endif
 
 #include "fm-file-ops-job-xfer.h"
+#include "fm-file-ops-job-private.h"
 #include "fm-file-ops-job-delete.h"
+#include "fm-file-ops-job-native.h"
+#include "fm-file-ops-job-journal.h"
+#include "fm-file-ops-job-stream.h"
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -45,6 +49,43 @@ static const char query[]=
 
 static void progress_cb(goffset cur, goffset total, gpointer job);
 
+/* max number of threads copying regular files concurrently */
+#define COPY_MAX_WORKERS 8
+/* remote servers often limit number of connections */
+#define COPY_MAX_REMOTE_WORKERS 3
+/* max number of files queued for copying but not copied yet */
+#define COPY_MAX_QUEUED 64
+
+typedef struct
+{
+    GThreadPool* pool;
+    GAsyncQueue* slots; /* free slots in the queue, limits memory usage */
+    volatile gint failed; /* set by any worker */
+} FmCopyPool;
+
+typedef struct
+{
+    FmFileOpsJob* job;
+    GFile* src;
+    GFile* dest;
+    GFileMonitor* dest_mon;
+    guint64 size;
+    goffset reported; /* part of job->current_file_finished owned by task */
+} FmCopyTask;
+
+/* only one question about existing file should be asked at a time */
+G_LOCK_DEFINE_STATIC(ask);
+
+static FmFileOpOption ask_rename(FmFileOpsJob* job, GFile* src, GFile* dest, GFile** new_dest)
+{
+    FmFileOpOption opt;
+
+    G_LOCK(ask);
+    opt = fm_file_ops_job_ask_rename(job, src, NULL, dest, new_dest);
+    G_UNLOCK(ask);
+    return opt;
+}
+
 static gboolean _fm_file_ops_job_check_paths(FmFileOpsJob* job, GFile* src, GFileInfo* src_inf, GFile* dest)
 {
     GError* err = NULL;
@@ -78,6 +119,275 @@ static gboolean _fm_file_ops_job_check_paths(FmFileOpsJob* job, GFile* src, GFil
     return (err == NULL);
 }
 
+/* checks if both files are remote and served by the same GVFS backend */
+static gboolean is_same_backend(GFile* src, GFile* dest)
+{
+    char* scheme;
+    gboolean ret;
+
+    if(g_file_is_native(src) || g_file_is_native(dest))
+        return FALSE;
+    scheme = g_file_get_uri_scheme(src);
+    ret = g_file_has_uri_scheme(dest, scheme);
+    g_free(scheme);
+    return ret;
+}
+
+#define JOURNAL_QUERY_ATTRS G_FILE_ATTRIBUTE_STANDARD_SIZE","G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+/* checks if dest was completely copied from src by previous run of the job
+   and neither of them was changed since then */
+static gboolean journal_is_done(FmFileOpsJournal* journal, GFile* src,
+                                GFile* dest, GCancellable* cancellable)
+{
+    const FmFileOpsJournalRecord* rec = _fm_file_ops_job_journal_lookup(journal, dest);
+    GFileInfo *src_inf, *dest_inf;
+    gboolean ret = FALSE;
+
+    if(!rec || !rec->done)
+        return FALSE;
+    src_inf = g_file_query_info(src, JOURNAL_QUERY_ATTRS,
+                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                cancellable, NULL);
+    if(!src_inf)
+        return FALSE;
+    dest_inf = g_file_query_info(dest, JOURNAL_QUERY_ATTRS,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 cancellable, NULL);
+    if(dest_inf)
+    {
+        ret = (g_file_info_get_size(src_inf) == rec->size &&
+               g_file_info_get_size(dest_inf) == rec->size &&
+               g_file_info_get_attribute_uint64(src_inf, G_FILE_ATTRIBUTE_TIME_MODIFIED) == rec->mtime);
+        g_object_unref(dest_inf);
+    }
+    g_object_unref(src_inf);
+    return ret;
+}
+
+/* records that dest is completely copied from src */
+static void journal_set_done(FmFileOpsJournal* journal, GFile* src, GFile* dest,
+                             GCancellable* cancellable)
+{
+    GFileInfo* inf = g_file_query_info(src, JOURNAL_QUERY_ATTRS,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       cancellable, NULL);
+    goffset size;
+
+    if(!inf)
+        return;
+    size = g_file_info_get_size(inf);
+    _fm_file_ops_job_journal_add(journal, dest, TRUE, size, size,
+                                 g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_TIME_MODIFIED));
+    g_object_unref(inf);
+}
+
+/* copies content of single file, handles existing destination and errors */
+static gboolean _fm_file_ops_job_copy_regular(FmFileOpsJob* job, GFile* src,
+                                              GFile* dest, GFileMonitor* dest_mon,
+                                              GFileProgressCallback progress,
+                                              gpointer progress_data,
+                                              gboolean* delete_src)
+{
+    gboolean ret = FALSE;
+    GError* err = NULL;
+    GFile* new_dest = NULL;
+    GFileCopyFlags flags;
+    FmJob* fmjob = FM_JOB(job);
+    gboolean copied;
+
+    /* skip files already copied if the job is resumed */
+    if(job->journal && journal_is_done((FmFileOpsJournal*)job->journal, src,
+                                       dest, fm_job_get_cancellable(fmjob)))
+    {
+        const FmFileOpsJournalRecord* rec;
+        rec = _fm_file_ops_job_journal_lookup((FmFileOpsJournal*)job->journal, dest);
+        progress(rec->size, rec->size, progress_data);
+        return TRUE;
+    }
+
+    flags = G_FILE_COPY_ALL_METADATA|G_FILE_COPY_NOFOLLOW_SYMLINKS;
+_retry_copy:
+    copied = FALSE;
+    /* local files are copied by kernel, without passing data through GIO */
+    if(g_file_is_native(src) && g_file_is_native(dest))
+        copied = _fm_file_ops_job_copy_native(job, src, dest, flags, progress,
+                                              progress_data, &err);
+    /* the same backend may copy the file without passing it through us */
+    else if(!is_same_backend(src, dest))
+        copied = _fm_file_ops_job_copy_stream(job, src, dest, flags, progress,
+                                              progress_data, &err);
+    if(!copied && g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        g_clear_error(&err);
+    if(!copied && !err)
+        copied = g_file_copy(src, dest, flags, fm_job_get_cancellable(fmjob),
+                             progress, progress_data, &err);
+    if(!copied)
+    {
+        flags &= ~G_FILE_COPY_OVERWRITE;
+
+        /* handle existing files */
+        if(err->domain == G_IO_ERROR && err->code == G_IO_ERROR_EXISTS)
+        {
+            GFile* dest_cp = new_dest;
+            FmFileOpOption opt = 0;
+            g_error_free(err);
+            err = NULL;
+
+            new_dest = NULL;
+            opt = ask_rename(job, src, dest, &new_dest);
+            if(!new_dest) /* restoring status quo */
+                new_dest = dest_cp;
+            else if(dest_cp) /* we got new new_dest, forget old one */
+                g_object_unref(dest_cp);
+            switch(opt)
+            {
+            case FM_FILE_OP_RENAME:
+                dest = new_dest;
+                goto _retry_copy;
+                break;
+            case FM_FILE_OP_OVERWRITE:
+                flags |= G_FILE_COPY_OVERWRITE;
+                goto _retry_copy;
+                break;
+            case FM_FILE_OP_CANCEL:
+                fm_job_cancel(fmjob);
+                break;
+            case FM_FILE_OP_SKIP:
+                ret = TRUE;
+                *delete_src = FALSE; /* don't delete source file. */
+                break;
+            case FM_FILE_OP_SKIP_ERROR: ; /* FIXME */
+            }
+        }
+        else
+        {
+            gboolean is_no_space = (err->domain == G_IO_ERROR &&
+                                    err->code == G_IO_ERROR_NO_SPACE);
+            FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MODERATE);
+            g_error_free(err);
+            err = NULL;
+            if(act == FM_JOB_RETRY)
+            {
+                progress(0, 0, progress_data); /* restart progress of file */
+                goto _retry_copy;
+            }
+            /* FIXME: ask to leave partial content? */
+            if(is_no_space)
+                g_file_delete(dest, fm_job_get_cancellable(fmjob), NULL);
+            ret = FALSE;
+            *delete_src = FALSE;
+        }
+    }
+    else
+    {
+        ret = TRUE;
+        if(job->journal)
+            journal_set_done((FmFileOpsJournal*)job->journal, src, dest,
+                             fm_job_get_cancellable(fmjob));
+        if(dest_mon)
+            g_file_monitor_emit_event(dest_mon, dest, NULL, G_FILE_MONITOR_EVENT_CREATED);
+    }
+
+    if(new_dest)
+        g_object_unref(new_dest);
+
+    return ret;
+}
+
+static void copy_task_progress_cb(goffset cur, goffset total, gpointer data)
+{
+    FmCopyTask* task = (FmCopyTask*)data;
+    FmFileOpsJob* job = task->job;
+
+    _fm_file_ops_job_add_progress(job, 0, cur - task->reported, 0);
+    task->reported = cur;
+    /* update progress */
+    fm_file_ops_job_emit_percent(job);
+}
+
+/* this is called from a thread of the pool */
+static void copy_task_run(gpointer data, gpointer user_data)
+{
+    FmCopyTask* task = (FmCopyTask*)data;
+    FmCopyPool* cp = (FmCopyPool*)user_data;
+    FmFileOpsJob* job = task->job;
+    gboolean delete_src = FALSE;
+
+    if(!fm_job_is_cancelled(FM_JOB(job)) &&
+       !_fm_file_ops_job_copy_regular(job, task->src, task->dest, task->dest_mon,
+                                      copy_task_progress_cb, task, &delete_src))
+        g_atomic_int_set(&cp->failed, TRUE);
+
+    _fm_file_ops_job_add_progress(job, task->size, -task->reported, 1);
+    fm_file_ops_job_emit_percent(job);
+
+    g_object_unref(task->src);
+    g_object_unref(task->dest);
+    if(task->dest_mon)
+        g_object_unref(task->dest_mon);
+    g_slice_free(FmCopyTask, task);
+    /* release the slot so the job may queue another file */
+    g_async_queue_push(cp->slots, cp);
+}
+
+static FmCopyPool* copy_pool_new(gboolean remote)
+{
+    FmCopyPool* cp;
+    GThreadPool* pool;
+    guint n_workers, i;
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    n_workers = CLAMP(g_get_num_processors(), 2, COPY_MAX_WORKERS);
+#else
+    n_workers = 4;
+#endif
+    /* few files in flight hide latency of the network well enough */
+    if(remote)
+        n_workers = MIN(n_workers, COPY_MAX_REMOTE_WORKERS);
+    cp = g_slice_new(FmCopyPool);
+    pool = g_thread_pool_new(copy_task_run, cp, n_workers, FALSE, NULL);
+    if(G_UNLIKELY(!pool))
+    {
+        g_slice_free(FmCopyPool, cp);
+        return NULL;
+    }
+    cp->pool = pool;
+    cp->slots = g_async_queue_new();
+    for(i = 0; i < COPY_MAX_QUEUED; i++)
+        g_async_queue_push(cp->slots, cp);
+    cp->failed = 0;
+    return cp;
+}
+
+static void copy_pool_push(FmCopyPool* cp, FmFileOpsJob* job, GFile* src,
+                           GFile* dest, guint64 size)
+{
+    FmCopyTask* task = g_slice_new(FmCopyTask);
+
+    task->job = job;
+    task->src = g_object_ref(src);
+    task->dest = g_object_ref(dest);
+    task->dest_mon = job->dest_folder_mon ? g_object_ref(job->dest_folder_mon) : NULL;
+    task->size = size;
+    task->reported = 0;
+    /* wait until there is a free slot in the queue */
+    g_async_queue_pop(cp->slots);
+    g_thread_pool_push(cp->pool, task, NULL);
+}
+
+/* waits for all queued files to be copied, returns FALSE if any failed */
+static gboolean copy_pool_free(FmCopyPool* cp)
+{
+    gboolean ret;
+
+    g_thread_pool_free(cp->pool, FALSE, TRUE);
+    ret = !g_atomic_int_get(&cp->failed);
+    g_async_queue_unref(cp->slots);
+    g_slice_free(FmCopyPool, cp);
+    return ret;
+}
+
 static gboolean _fm_file_ops_job_copy_file(FmFileOpsJob* job, GFile* src, GFileInfo* inf, GFile* dest)
 {
     gboolean ret = FALSE;
@@ -86,7 +396,6 @@ static gboolean _fm_file_ops_job_copy_file(FmFileOpsJob* job, GFile* src, GFileI
     GFileType type;
     guint64 size;
     GFile* new_dest = NULL;
-    GFileCopyFlags flags;
     FmJob* fmjob = FM_JOB(job);
     guint32 mode;
     gboolean skip_dir_content = FALSE;
@@ -132,6 +441,11 @@ _retry_query_src_info:
     g_object_unref(inf);
     inf = NULL;
 
+    /* warn the user if the files will not fit into destination before
+       anything is written there */
+    if(!_fm_file_ops_job_check_space(job))
+        return FALSE;
+
     switch(type)
     {
     case G_FILE_TYPE_DIRECTORY:
@@ -150,7 +464,7 @@ _retry_mkdir:
                     err = NULL;
 
                     new_dest = NULL;
-                    opt = fm_file_ops_job_ask_rename(job, src, NULL, dest, &new_dest);
+                    opt = ask_rename(job, src, dest, &new_dest);
                     if(!new_dest) /* restoring status quo */
                         new_dest = dest_cp;
                     else if(dest_cp) /* we got new new_dest, forget old one */
@@ -163,7 +477,7 @@ _retry_mkdir:
                         break;
                     case FM_FILE_OP_SKIP:
                         /* when a dir is skipped, we need to know its total size to calculate correct progress */
-                        job->finished += size;
+                        _fm_file_ops_job_add_progress(job, size, 0, 0);
                         fm_file_ops_job_emit_percent(job);
                         job->skip_dir_content = skip_dir_content = TRUE;
                         dir_created = TRUE; /* pretend that dir creation succeeded */
@@ -185,7 +499,7 @@ _retry_mkdir:
                     if(act == FM_JOB_RETRY)
                         goto _retry_mkdir;
                 }
-                job->finished += size;
+                _fm_file_ops_job_add_progress(job, size, 0, 1);
                 fm_file_ops_job_emit_percent(job);
             }
             else
@@ -211,7 +525,7 @@ _retry_chmod_for_dir:
                     }
                     dir_created = TRUE;
                 }
-                job->finished += size;
+                _fm_file_ops_job_add_progress(job, size, 0, 1);
                 fm_file_ops_job_emit_percent(job);
 
                 if(job->dest_folder_mon)
@@ -246,7 +560,7 @@ _retry_enum_children:
                             if(G_UNLIKELY(job->skip_dir_content))
                             {
                                 /* FIXME: this is incorrect as we don't do the calculation recursively. */
-                                job->finished += g_file_info_get_size(inf);
+                                _fm_file_ops_job_add_progress(job, g_file_info_get_size(inf), 0, 1);
                                 fm_file_ops_job_emit_percent(job);
                             }
                             else
@@ -373,82 +687,22 @@ _retry_enum_children:
             fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MODERATE);
             g_clear_error(&err);
         }
-        job->finished += size;
+        _fm_file_ops_job_add_progress(job, size, 0, 1);
         fm_file_ops_job_emit_percent(job);
         break;
 
     default:
-        flags = G_FILE_COPY_ALL_METADATA|G_FILE_COPY_NOFOLLOW_SYMLINKS;
-_retry_copy:
-        if( !g_file_copy(src, dest, flags, fm_job_get_cancellable(fmjob),
-                         progress_cb, fmjob, &err) )
+        if(job->copy_pool)
         {
-            flags &= ~G_FILE_COPY_OVERWRITE;
-
-            /* handle existing files */
-            if(err->domain == G_IO_ERROR && err->code == G_IO_ERROR_EXISTS)
-            {
-                GFile* dest_cp = new_dest;
-                FmFileOpOption opt = 0;
-                g_error_free(err);
-                err = NULL;
-
-                new_dest = NULL;
-                opt = fm_file_ops_job_ask_rename(job, src, NULL, dest, &new_dest);
-                if(!new_dest) /* restoring status quo */
-                    new_dest = dest_cp;
-                else if(dest_cp) /* we got new new_dest, forget old one */
-                    g_object_unref(dest_cp);
-                switch(opt)
-                {
-                case FM_FILE_OP_RENAME:
-                    dest = new_dest;
-                    goto _retry_copy;
-                    break;
-                case FM_FILE_OP_OVERWRITE:
-                    flags |= G_FILE_COPY_OVERWRITE;
-                    goto _retry_copy;
-                    break;
-                case FM_FILE_OP_CANCEL:
-                    fm_job_cancel(fmjob);
-                    break;
-                case FM_FILE_OP_SKIP:
-                    ret = TRUE;
-                    delete_src = FALSE; /* don't delete source file. */
-                    break;
-                case FM_FILE_OP_SKIP_ERROR: ; /* FIXME */
-                }
-            }
-            else
-            {
-                gboolean is_no_space = (err->domain == G_IO_ERROR &&
-                                        err->code == G_IO_ERROR_NO_SPACE);
-                FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MODERATE);
-                g_error_free(err);
-                err = NULL;
-                if(act == FM_JOB_RETRY)
-                {
-                    job->current_file_finished = 0;
-                    goto _retry_copy;
-                }
-                /* FIXME: ask to leave partial content? */
-                if(is_no_space)
-                    g_file_delete(dest, fm_job_get_cancellable(fmjob), NULL);
-                ret = FALSE;
-                delete_src = FALSE;
-            }
-        }
-        else
+            /* let a worker copy the file while we go on with the tree */
+            copy_pool_push((FmCopyPool*)job->copy_pool, job, src, dest, size);
             ret = TRUE;
-
-        job->finished += size;
-        job->current_file_finished = 0;
-
-        if( ret && type != G_FILE_TYPE_DIRECTORY )
-        {
-            if(job->dest_folder_mon)
-                g_file_monitor_emit_event(job->dest_folder_mon, dest, NULL, G_FILE_MONITOR_EVENT_CREATED);
+            delete_src = FALSE; /* the pool is used only for copying */
+            break;
         }
+        ret = _fm_file_ops_job_copy_regular(job, src, dest, job->dest_folder_mon,
+                                            progress_cb, job, &delete_src);
+        _fm_file_ops_job_add_progress(job, size, -job->current_file_finished, 1);
 
         /* update progress */
         fm_file_ops_job_emit_percent(job);
@@ -621,7 +875,7 @@ _retry_move:
 */
         size = g_file_info_get_size(inf);
 
-        job->finished += size;
+        _fm_file_ops_job_add_progress(job, size, 0, 1);
         fm_file_ops_job_emit_percent(job);
     }
     else /* use copy if they are on different devices */
@@ -641,7 +895,7 @@ _retry_move:
 static void progress_cb(goffset cur, goffset total, gpointer data)
 {
     FmFileOpsJob* job = FM_FILE_OPS_JOB(data);
-    job->current_file_finished = cur;
+    _fm_file_ops_job_add_progress(job, 0, cur - job->current_file_finished, 0);
     /* update progress */
     fm_file_ops_job_emit_percent(job);
 }
@@ -653,19 +907,10 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
     GFileMonitor *old_mon;
     GList* l;
     FmJob* fmjob = FM_JOB(job);
-    /* prepare the job, count total work needed with FmDeepCountJob */
-    FmDeepCountJob* dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_DEFAULT);
-    /* let the deep count job share the same cancellable object. */
-    fm_job_set_cancellable(FM_JOB(dc), fm_job_get_cancellable(fmjob));
-    fm_job_run_sync(FM_JOB(dc));
-    job->total = dc->total_size;
-    if(fm_job_is_cancelled(fmjob))
-    {
-        g_object_unref(dc);
-        return FALSE;
-    }
-    g_object_unref(dc);
-    g_debug("total size to copy: %llu", (long long unsigned int)job->total);
+
+    /* count total work needed with FmDeepCountJob while copying is going */
+    _fm_file_ops_job_start_count(job, fm_deep_count_job_new(job->srcs, FM_DC_JOB_DEFAULT),
+                                 FALSE);
 
     dest_dir = fm_path_to_gfile(job->dest);
     /* get dummy file monitors for non-native filesystems */
@@ -675,6 +920,14 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
     else
         job->dest_folder_mon = fm_monitor_lookup_dummy_monitor(dest_dir);
 
+    /* trees with lots of small files are copied much faster if we don't
+       wait for each file to be copied before going to the next one, so
+       let's walk the tree here and leave regular files to the workers.
+       Directories are still created in order so files have a place. */
+    job->copy_pool = copy_pool_new(!g_file_is_native(dest_dir));
+    if(job->resumable)
+        job->journal = _fm_file_ops_job_journal_open(job);
+
     fm_file_ops_job_emit_prepared(job);
 
     for(l = fm_path_list_peek_head_link(job->srcs); !fm_job_is_cancelled(fmjob) && l; l=l->next)
@@ -702,6 +955,22 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
         g_object_unref(dest);
     }
 
+    if(job->copy_pool)
+    {
+        /* wait for the workers to finish with queued files */
+        if(!copy_pool_free((FmCopyPool*)job->copy_pool))
+            ret = FALSE;
+        job->copy_pool = NULL;
+    }
+    _fm_file_ops_job_finish_count(job);
+    if(job->journal)
+    {
+        /* keep the journal if the job should be resumed later */
+        _fm_file_ops_job_journal_close((FmFileOpsJournal*)job->journal,
+                                       ret && !fm_job_is_cancelled(fmjob));
+        job->journal = NULL;
+    }
+
     /* g_debug("finished: %llu, total: %llu", job->finished, job->total); */
     fm_file_ops_job_emit_percent(job);
 
@@ -712,6 +981,80 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
     return ret;
 }
 
+/* checks if all sources are local and on the device dev, total size of
+   top level items is returned in total */
+static gboolean all_on_device(FmPathList* srcs, dev_t dev, goffset* total)
+{
+    GList* l;
+    struct stat st;
+    char* path_str;
+    int r;
+
+    *total = 0;
+    for(l = fm_path_list_peek_head_link(srcs); l; l = l->next)
+    {
+        FmPath* path = FM_PATH(l->data);
+        if(!fm_path_is_native(path))
+            return FALSE;
+        path_str = fm_path_to_str(path);
+        r = lstat(path_str, &st);
+        g_free(path_str);
+        /* GIO keeps only 32 bits of device ID */
+        if(r < 0 || (guint32)st.st_dev != (guint32)dev)
+            return FALSE;
+        *total += st.st_size;
+    }
+    return TRUE;
+}
+
+/* moves files which are all on the destination device by renaming them,
+   without traversal of folders */
+static gboolean _fm_file_ops_job_move_by_rename(FmFileOpsJob* job, GFile* dest_dir)
+{
+    FmJob* fmjob = FM_JOB(job);
+    char* dest_dir_path = g_file_get_path(dest_dir);
+    gboolean ret = TRUE;
+    GList* l;
+
+    g_debug("total size to move: %llu, renaming only",
+            (long long unsigned int)job->total);
+    fm_file_ops_job_emit_prepared(job);
+
+    for(l = fm_path_list_peek_head_link(job->srcs); !fm_job_is_cancelled(fmjob) && l; l=l->next)
+    {
+        FmPath* path = FM_PATH(l->data);
+        char* src_path = fm_path_to_str(path);
+        char* dest_path = g_build_filename(dest_dir_path, fm_path_get_basename(path), NULL);
+        struct stat st;
+
+        if(lstat(src_path, &st) == 0 && _fm_file_ops_job_rename_native(src_path, dest_path))
+        {
+            char* disp = fm_path_display_basename(path);
+            fm_file_ops_job_emit_cur_file(job, disp);
+            g_free(disp);
+            _fm_file_ops_job_add_progress(job, st.st_size, 0, 1);
+            fm_file_ops_job_emit_percent(job);
+        }
+        else
+        {
+            /* existing destination, moving into itself, bind mounts, etc.:
+               let the generic code handle it and ask user if needed */
+            GFile* src = g_file_new_for_path(src_path);
+            GFile* dest = g_file_new_for_path(dest_path);
+            if(!_fm_file_ops_job_move_file(job, src, NULL, dest))
+                ret = FALSE;
+            g_object_unref(src);
+            g_object_unref(dest);
+        }
+        g_free(src_path);
+        g_free(dest_path);
+        if(!ret)
+            break;
+    }
+    g_free(dest_dir_path);
+    return ret;
+}
+
 gboolean _fm_file_ops_job_move_run(FmFileOpsJob* job)
 {
     GFile *dest_dir;
@@ -721,6 +1064,7 @@ gboolean _fm_file_ops_job_move_run(FmFileOpsJob* job)
     GError* err = NULL;
     FmJob* fmjob = FM_JOB(job);
     dev_t dest_dev = 0;
+    goffset total;
     gboolean ret = TRUE;
     FmDeepCountJob* dc;
 
@@ -753,21 +1097,21 @@ _retry_query_dest_info:
         }
     }
 
-    /* prepare the job, count total work needed with FmDeepCountJob */
-    dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_PREPARE_MOVE);
-    fm_deep_count_job_set_dest(dc, dest_dev, job->dest_fs_id);
-    fm_job_run_sync(FM_JOB(dc));
-    job->total = dc->total_size;
-
-    if( fm_job_is_cancelled(FM_JOB(dc)) )
+    /* if everything is on the same device then counting is useless since
+       each item is just renamed, no matter how big it is */
+    if(g_file_is_native(dest_dir) && all_on_device(job->srcs, dest_dev, &total))
     {
+        _fm_file_ops_job_set_total(job, total);
+        ret = _fm_file_ops_job_move_by_rename(job, dest_dir);
         g_object_unref(dest_dir);
-        g_object_unref(dc);
-        return FALSE;
+        return ret;
     }
-    g_object_unref(dc);
-    g_debug("total size to move: %llu, dest_fs: %s",
-            (long long unsigned int)job->total, job->dest_fs_id);
+
+    /* count total work needed with FmDeepCountJob while moving is going */
+    dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_PREPARE_MOVE);
+    fm_deep_count_job_set_dest(dc, dest_dev, job->dest_fs_id);
+    _fm_file_ops_job_start_count(job, dc, FALSE);
+    g_debug("moving files, dest_fs: %s", job->dest_fs_id);
 
     /* get dummy file monitors for non-native filesystems */
     old_mon = job->dest_folder_mon;
@@ -775,6 +1119,8 @@ _retry_query_dest_info:
         job->dest_folder_mon = NULL;
     else
         job->dest_folder_mon = fm_monitor_lookup_dummy_monitor(dest_dir);
+    if(job->resumable)
+        job->journal = _fm_file_ops_job_journal_open(job);
 
     fm_file_ops_job_emit_prepared(job);
 
@@ -822,6 +1168,14 @@ _retry_query_dest_info:
             break;
     }
     job->src_folder_mon = old_src_mon;
+    _fm_file_ops_job_finish_count(job);
+    if(job->journal)
+    {
+        _fm_file_ops_job_journal_close((FmFileOpsJournal*)job->journal,
+                                       ret && !fm_job_is_cancelled(fmjob));
+        job->journal = NULL;
+    }
+    fm_file_ops_job_emit_percent(job);
 
     g_object_unref(dest_dir);
     if(job->dest_folder_mon)
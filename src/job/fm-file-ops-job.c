@@ -36,13 +36,23 @@
 #endif
 
 #include <glib/gi18n-lib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_STATVFS_H
+#include <sys/statvfs.h>
+#endif
 
 #include "fm-file-ops-job.h"
+#include "fm-file-ops-job-private.h"
+#include "fm-deep-count-job-private.h"
 #include "fm-file-ops-job-xfer.h"
 #include "fm-file-ops-job-delete.h"
 #include "fm-file-ops-job-change-attr.h"
 #include "fm-marshal.h"
 #include "fm-file-info-job.h"
+#include "fm-config.h"
+#include "fm-utils.h"
 #include "glib-compat.h"
 
 enum
@@ -51,14 +61,69 @@ enum
     CUR_FILE,
     PERCENT,
     ASK_RENAME,
+    RATE,
     N_SIGNALS
 };
 
 static guint signals[N_SIGNALS];
 
+/* protects job->percent and counters of work done since progress may be
+   reported from many threads */
+G_LOCK_DEFINE_STATIC(percent);
+
+/* how often progress of the job running asynchronously is sampled by the
+   main thread, in milliseconds */
+#define PROGRESS_REFRESH_INTERVAL 200
+/* how often the transfer rate is recalculated, in seconds */
+#define RATE_UPDATE_INTERVAL 1.0
+/* time constant of the rate smoothing, in seconds */
+#define RATE_SMOOTHING_TIME 5.0
+/* how often size counted so far is compared with free space while the
+   first write waits for the count, in milliseconds */
+#define SPACE_CHECK_INTERVAL 100
+
+/* the transfer rate estimation and the progress which is not shown yet,
+   protected by the percent lock */
+typedef struct
+{
+    volatile gint sampled; /* progress is sampled by the main thread */
+    char* cur_file; /* the last file reported by the job, not shown yet */
+    GTimer* timer; /* started when the job is prepared */
+    gdouble last_time; /* time of the last sample */
+    goffset last_done;
+    guint last_files;
+    gdouble rate; /* smoothed amount per second */
+    gdouble files_rate; /* smoothed number of files per second */
+    goffset avg_rate;
+    guint files; /* number of processed files */
+    guint total_files; /* 0 if unknown */
+    gint remaining; /* seconds, -1 if unknown */
+} FmFileOpsRate;
+
+/* the deep count running concurrently with the job, see
+   _fm_file_ops_job_start_count() */
+typedef struct
+{
+    FmDeepCountJob* dc;
+    GThread* thread;
+    gulong handler; /* handler of job cancellation */
+    gboolean by_count; /* use number of files instead of size as total */
+    volatile gint done;
+    GAsyncQueue* finished; /* receives a token when the count is done */
+    /* for _fm_file_ops_job_check_space() */
+    goffset dest_free; /* -1 if unknown */
+    guint dest_bsize; /* 0 if not queried yet */
+    gboolean keeps_holes; /* files are copied natively, sparse files stay sparse */
+    volatile gint space_checked;
+} FmFileOpsCounter;
+
+/* _fm_file_ops_job_check_space() may be called by many workers at once */
+G_LOCK_DEFINE_STATIC(space);
+
 static void fm_file_ops_job_finalize              (GObject *object);
 
 static gboolean fm_file_ops_job_run(FmJob* fm_job);
+static gboolean fm_file_ops_job_run_async(FmJob* fm_job);
 /* static void fm_file_ops_job_cancel(FmJob* job); */
 
 /* funcs for io jobs */
@@ -115,6 +180,7 @@ static void fm_file_ops_job_class_init(FmFileOpsJobClass *klass)
 
     job_class = FM_JOB_CLASS(klass);
     job_class->run = fm_file_ops_job_run;
+    job_class->run_async = fm_file_ops_job_run_async;
 
     /**
      * FmFileOpsJob::prepared:
@@ -199,6 +265,26 @@ static void fm_file_ops_job_class_init(FmFileOpsJobClass *klass)
                       fm_marshal_INT__POINTER_POINTER_POINTER,
                       G_TYPE_INT, 3, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER );
 
+    /**
+     * FmFileOpsJob::rate:
+     * @job: a job object which emitted the signal
+     *
+     * The #FmFileOpsJob::rate signal is emitted about once a second
+     * while @job is in progress, when the estimation of transfer rate
+     * and remaining time is updated. Use fm_file_ops_job_get_rate() to
+     * retrieve new values.
+     *
+     * Since: 1.2.0
+     */
+    signals[RATE] =
+        g_signal_new( "rate",
+                      G_TYPE_FROM_CLASS ( klass ),
+                      G_SIGNAL_RUN_FIRST,
+                      G_STRUCT_OFFSET ( FmFileOpsJobClass, rate ),
+                      NULL, NULL,
+                      g_cclosure_marshal_VOID__VOID,
+                      G_TYPE_NONE, 0 );
+
 }
 
 
@@ -214,14 +300,24 @@ static void fm_file_ops_job_finalize(GObject *object)
     g_assert(self->src_folder_mon == NULL);
     g_assert(self->dest_folder_mon == NULL);
 
+    g_timer_destroy(((FmFileOpsRate*)self->rate)->timer);
+    g_free(((FmFileOpsRate*)self->rate)->cur_file);
+    g_slice_free(FmFileOpsRate, self->rate);
+
     G_OBJECT_CLASS(fm_file_ops_job_parent_class)->finalize(object);
 }
 
 
 static void fm_file_ops_job_init(FmFileOpsJob *self)
 {
+    FmFileOpsRate* rate = g_slice_new0(FmFileOpsRate);
+
     fm_job_init_cancellable(FM_JOB(self));
 
+    rate->timer = g_timer_new();
+    rate->remaining = -1;
+    self->rate = rate;
+
     /* for chown */
     self->uid = -1;
     self->gid = -1;
@@ -248,27 +344,76 @@ FmFileOpsJob *fm_file_ops_job_new(FmFileOpType type, FmPathList* files)
 }
 
 
+static void sample_progress(FmFileOpsJob* job);
+
+static gpointer sample_progress_in_main_thread(FmJob* job, gpointer unused)
+{
+    sample_progress(FM_FILE_OPS_JOB(job));
+    return NULL;
+}
+
 static gboolean fm_file_ops_job_run(FmJob* fm_job)
 {
     FmFileOpsJob* job = FM_FILE_OPS_JOB(fm_job);
+    gboolean ret = FALSE;
+
     switch(job->type)
     {
     case FM_FILE_OP_COPY:
-        return _fm_file_ops_job_copy_run(job);
+        ret = _fm_file_ops_job_copy_run(job);
+        break;
     case FM_FILE_OP_MOVE:
-        return _fm_file_ops_job_move_run(job);
+        ret = _fm_file_ops_job_move_run(job);
+        break;
     case FM_FILE_OP_TRASH:
-        return _fm_file_ops_job_trash_run(job);
+        ret = _fm_file_ops_job_trash_run(job);
+        break;
     case FM_FILE_OP_UNTRASH:
-        return _fm_file_ops_job_untrash_run(job);
+        ret = _fm_file_ops_job_untrash_run(job);
+        break;
     case FM_FILE_OP_DELETE:
-        return _fm_file_ops_job_delete_run(job);
+        ret = _fm_file_ops_job_delete_run(job);
+        break;
     case FM_FILE_OP_LINK:
-        return _fm_file_ops_job_link_run(job);
+        ret = _fm_file_ops_job_link_run(job);
+        break;
     case FM_FILE_OP_CHANGE_ATTR:
-        return _fm_file_ops_job_change_attr_run(job);
+        ret = _fm_file_ops_job_change_attr_run(job);
+        break;
     case FM_FILE_OP_NONE: ;
     }
+    /* show the final progress before the job is finished */
+    if(g_atomic_int_get(&((FmFileOpsRate*)job->rate)->sampled))
+        fm_job_call_main_thread(fm_job, sample_progress_in_main_thread, NULL);
+    return ret;
+}
+
+static gboolean on_sample_progress(gpointer user_data)
+{
+    FmFileOpsJob* job = FM_FILE_OPS_JOB(user_data);
+
+    sample_progress(job);
+    if(fm_job_is_running(FM_JOB(job)))
+        return TRUE;
+    g_atomic_int_set(&((FmFileOpsRate*)job->rate)->sampled, 0);
+    return FALSE;
+}
+
+static gboolean fm_file_ops_job_run_async(FmJob* fm_job)
+{
+    FmFileOpsRate* rate = (FmFileOpsRate*)FM_FILE_OPS_JOB(fm_job)->rate;
+    guint id;
+
+    /* the main thread takes progress from the job at the fixed rate so
+       working threads never wait for it */
+    g_atomic_int_set(&rate->sampled, 1);
+    id = g_timeout_add_full(G_PRIORITY_DEFAULT, PROGRESS_REFRESH_INTERVAL,
+                            on_sample_progress, g_object_ref(fm_job),
+                            g_object_unref);
+    if(FM_JOB_CLASS(fm_file_ops_job_parent_class)->run_async(fm_job))
+        return TRUE;
+    g_source_remove(id);
+    g_atomic_int_set(&rate->sampled, 0);
     return FALSE;
 }
 
@@ -369,6 +514,49 @@ void fm_file_ops_job_set_recursive(FmFileOpsJob* job, gboolean recursive)
     job->recursive = recursive;
 }
 
+/**
+ * fm_file_ops_job_set_resumable
+ * @job: a job to set
+ * @resumable: %TRUE to keep a journal of copied files
+ *
+ * Sets whether copy or move operation @job keeps a journal of its progress.
+ * If the job with the same sources and destination was interrupted before
+ * then files which were completely copied are skipped, and large files
+ * which were partially copied are continued from the last checkpoint
+ * instead of being copied from the beginning. The journal is removed once
+ * the job finishes successfully.
+ *
+ * This API may be used only before @job is started.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_ops_job_set_resumable(FmFileOpsJob* job, gboolean resumable)
+{
+    job->resumable = resumable;
+}
+
+/**
+ * fm_file_ops_job_set_direct_io
+ * @job: a job to set
+ * @threshold: minimal size of file to copy without caching, or 0
+ *
+ * Sets copy or move operation @job to copy local files of at least
+ * @threshold bytes with direct I/O, bypassing the page cache entirely.
+ * This is useful for very large files which would never be read again
+ * soon, such as backups or disk images. If the filesystem does not
+ * support direct I/O then files are copied as usual. Value 0 disables
+ * direct I/O, which is the default; large files are still dropped from
+ * the page cache as they are copied in that case.
+ *
+ * This API may be used only before @job is started.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_ops_job_set_direct_io(FmFileOpsJob* job, goffset threshold)
+{
+    job->direct_io_threshold = threshold;
+}
+
 static gpointer emit_cur_file(FmJob* job, gpointer cur_file)
 {
     g_signal_emit(job, signals[CUR_FILE], 0, (const char*)cur_file);
@@ -380,7 +568,9 @@ static gpointer emit_cur_file(FmJob* job, gpointer cur_file)
  * @job: the job to emit signal
  * @cur_file: the data to emit
  *
- * Emits the #FmFileOpsJob::cur-file signal in main thread.
+ * Emits the #FmFileOpsJob::cur-file signal in main thread. If @job runs
+ * asynchronously then the signal is emitted on next refresh of progress
+ * for the last file reported, so this call never waits for main thread.
  *
  * This API is private to #FmFileOpsJob and should not be used outside
  * of libfm implementation.
@@ -389,7 +579,100 @@ static gpointer emit_cur_file(FmJob* job, gpointer cur_file)
  */
 void fm_file_ops_job_emit_cur_file(FmFileOpsJob* job, const char* cur_file)
 {
-    fm_job_call_main_thread(FM_JOB(job), emit_cur_file, (gpointer)cur_file);
+    FmFileOpsRate* rate = (FmFileOpsRate*)job->rate;
+
+    if(g_atomic_int_get(&rate->sampled))
+    {
+        char* old;
+
+        G_LOCK(percent);
+        old = rate->cur_file;
+        rate->cur_file = g_strdup(cur_file);
+        G_UNLOCK(percent);
+        g_free(old);
+    }
+    else
+        fm_job_call_main_thread(FM_JOB(job), emit_cur_file, (gpointer)cur_file);
+}
+
+static gpointer emit_rate(FmJob* job, gpointer unused)
+{
+    g_signal_emit(job, signals[RATE], 0);
+    return NULL;
+}
+
+/* takes new sample of the work done; should be called with percent lock
+   held; returns TRUE if estimation was updated */
+static gboolean update_rate(FmFileOpsJob* job, gboolean total_known)
+{
+    FmFileOpsRate* rate = (FmFileOpsRate*)job->rate;
+    gdouble now, dt, alpha, remaining, remaining_files;
+    goffset done;
+    guint files;
+
+    now = g_timer_elapsed(rate->timer, NULL);
+    dt = now - rate->last_time;
+    if(dt < RATE_UPDATE_INTERVAL)
+        return FALSE;
+    done = job->finished + job->current_file_finished;
+    files = rate->files;
+    /* exponentially weighted moving average, the weight of the new
+       sample depends on time passed since previous one */
+    alpha = 1.0 - exp(-dt / RATE_SMOOTHING_TIME);
+    if(rate->last_time == 0.0) /* first sample */
+        alpha = 1.0;
+    rate->rate += alpha * ((done - rate->last_done) / dt - rate->rate);
+    rate->files_rate += alpha * ((files - rate->last_files) / dt - rate->files_rate);
+    rate->avg_rate = (goffset)(done / now);
+    rate->last_time = now;
+    rate->last_done = done;
+    rate->last_files = files;
+
+    /* copying of small files is bound by number of files per second
+       rather than by throughput, so take the worse of two estimations */
+    rate->remaining = -1;
+    if(total_known && rate->rate > 0.0)
+    {
+        remaining = MAX(job->total - done, 0) / rate->rate;
+        if(rate->total_files > files && rate->files_rate > 0.0)
+        {
+            remaining_files = (rate->total_files - files) / rate->files_rate;
+            remaining = MAX(remaining, remaining_files);
+        }
+        rate->remaining = (gint)MIN(remaining, G_MAXINT);
+    }
+    return TRUE;
+}
+
+/**
+ * fm_file_ops_job_get_rate
+ * @job: the job to inspect
+ * @rate: (out) (allow-none): location to store current rate
+ * @avg_rate: (out) (allow-none): location to store average rate
+ * @remaining: (out) (allow-none): location to store remaining time
+ *
+ * Retrieves current estimation of transfer rate for the @job. The @rate
+ * is smoothed over last few seconds, the @avg_rate is calculated since
+ * the job was started. Both are in bytes per second for copy and move
+ * operations and in files per second for the rest. The @remaining time
+ * is in seconds and is -1 if it is not known yet. Values are updated
+ * each time the #FmFileOpsJob::rate signal is emitted.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_ops_job_get_rate(FmFileOpsJob* job, goffset* rate, goffset* avg_rate,
+                              gint* remaining)
+{
+    FmFileOpsRate* r = (FmFileOpsRate*)job->rate;
+
+    G_LOCK(percent);
+    if(rate)
+        *rate = (goffset)r->rate;
+    if(avg_rate)
+        *avg_rate = r->avg_rate;
+    if(remaining)
+        *remaining = r->remaining;
+    G_UNLOCK(percent);
 }
 
 static gpointer emit_percent(FmJob* job, gpointer percent)
@@ -398,11 +681,83 @@ static gpointer emit_percent(FmJob* job, gpointer percent)
     return NULL;
 }
 
+/* returns total work counted so far by the concurrent count */
+static goffset get_counted_total(FmFileOpsCounter* cnt)
+{
+    guint count;
+    goffset total_size;
+
+    _fm_deep_count_job_get_totals(cnt->dc, &count, &total_size, NULL);
+    return cnt->by_count ? count : total_size;
+}
+
+/* takes new sample of the work done; should be called with percent lock
+   held; returns new percent or 0 if it should not be emitted */
+static guint update_percent(FmFileOpsJob* job, gboolean* rate_updated)
+{
+    FmFileOpsCounter* cnt = (FmFileOpsCounter*)job->counter;
+    guint percent;
+    gboolean counting;
+
+    counting = (cnt && !g_atomic_int_get(&cnt->done));
+    if(counting)
+        /* refine the total with counted part */
+        job->total = get_counted_total(cnt);
+    *rate_updated = update_rate(job, !counting);
+    if(job->total > 0)
+    {
+        gdouble dpercent = (gdouble)(job->finished + job->current_file_finished) / job->total;
+        percent = (guint)(dpercent * 100);
+        if(percent > 100)
+            percent = 100;
+        /* the total counted so far is too small so the percent is too
+           high; it is not emitted again until the work catches up with it
+           and never reaches 100 before the count is finished */
+        if(counting && percent > 99)
+            percent = 99;
+    }
+    else
+        percent = counting ? 0 : 100;
+
+    if( percent > job->percent )
+        job->percent = percent;
+    else
+        percent = 0;
+    return percent;
+}
+
+/* emits signals for progress made since the last sample, in main thread */
+static void sample_progress(FmFileOpsJob* job)
+{
+    FmFileOpsRate* rate = (FmFileOpsRate*)job->rate;
+    gboolean rate_updated;
+    char* cur_file;
+    guint percent;
+
+    G_LOCK(percent);
+    cur_file = rate->cur_file;
+    rate->cur_file = NULL;
+    percent = update_percent(job, &rate_updated);
+    G_UNLOCK(percent);
+    if(cur_file)
+    {
+        g_signal_emit(job, signals[CUR_FILE], 0, cur_file);
+        g_free(cur_file);
+    }
+    if(rate_updated)
+        g_signal_emit(job, signals[RATE], 0);
+    if(percent > 0)
+        g_signal_emit(job, signals[PERCENT], 0, percent);
+}
+
 /**
  * fm_file_ops_job_emit_percent
  * @job: the job to emit signal
  *
- * Emits the #FmFileOpsJob::percent signal in main thread.
+ * Emits the #FmFileOpsJob::percent signal in main thread. If @job runs
+ * asynchronously then main thread samples progress itself at the fixed
+ * rate, and this call does nothing, so callers only need to update the
+ * counters of @job before it.
  *
  * This API is private to #FmFileOpsJob and should not be used outside
  * of libfm implementation.
@@ -412,21 +767,330 @@ static gpointer emit_percent(FmJob* job, gpointer percent)
 void fm_file_ops_job_emit_percent(FmFileOpsJob* job)
 {
     guint percent;
-    if(job->total > 0)
+    gboolean rate_updated;
+
+    if(g_atomic_int_get(&((FmFileOpsRate*)job->rate)->sampled))
+        return;
+    G_LOCK(percent);
+    percent = update_percent(job, &rate_updated);
+    G_UNLOCK(percent);
+    if(rate_updated)
+        fm_job_call_main_thread(FM_JOB(job), emit_rate, NULL);
+    if(percent > 0)
+        fm_job_call_main_thread(FM_JOB(job), emit_percent, GUINT_TO_POINTER(percent));
+}
+
+/*
+ * _fm_file_ops_job_add_progress
+ * @job: the job to update
+ * @finished: size of work finished
+ * @current: change of the part of files in progress which is done
+ * @n_files: number of files finished
+ *
+ * Updates counters of the work done by @job. Counters may be updated by
+ * many threads of the job at once and are sampled by the main thread so
+ * they should never be changed directly. The @n_files is used for the
+ * rate of files per second, so it should count each entry processed,
+ * including ones which are reported in batches.
+ */
+void _fm_file_ops_job_add_progress(FmFileOpsJob* job, goffset finished,
+                                   goffset current, guint n_files)
+{
+    G_LOCK(percent);
+    job->finished += finished;
+    job->current_file_finished += current;
+    ((FmFileOpsRate*)job->rate)->files += n_files;
+    G_UNLOCK(percent);
+}
+
+/*
+ * _fm_file_ops_job_set_total
+ * @job: the job to update
+ * @total: size of the whole work
+ *
+ * Sets total work of @job if it is not counted concurrently, see
+ * _fm_file_ops_job_start_count().
+ */
+void _fm_file_ops_job_set_total(FmFileOpsJob* job, goffset total)
+{
+    G_LOCK(percent);
+    job->total = total;
+    G_UNLOCK(percent);
+}
+
+static gpointer count_thread(gpointer user_data)
+{
+    FmFileOpsJob* job = FM_FILE_OPS_JOB(user_data);
+    FmFileOpsCounter* cnt = (FmFileOpsCounter*)job->counter;
+    guint count;
+    goffset total_size;
+
+    fm_job_run_sync(FM_JOB(cnt->dc));
+    _fm_deep_count_job_get_totals(cnt->dc, &count, &total_size, NULL);
+    G_LOCK(percent);
+    job->total = cnt->by_count ? count : total_size;
+    if(!cnt->by_count)
+        ((FmFileOpsRate*)job->rate)->total_files = count;
+    g_atomic_int_set(&cnt->done, 1);
+    G_UNLOCK(percent);
+    g_async_queue_push(cnt->finished, GINT_TO_POINTER(1));
+    g_debug("total counted for the job: %llu", (long long unsigned int)job->total);
+    /* percent will be emitted by the job itself since the main thread may
+       be waiting for the job and therefore cannot be called from here */
+    return NULL;
+}
+
+static void on_job_cancelled(GCancellable* cancellable, FmDeepCountJob* dc)
+{
+    fm_job_cancel(FM_JOB(dc));
+}
+
+/*
+ * _fm_file_ops_job_start_count
+ * @job: the job to count total for
+ * @dc: (transfer full): the deep count job to run
+ * @by_count: %TRUE to use number of files as total instead of their size
+ *
+ * Starts @dc in a separate thread so the @job can do the work without
+ * waiting for the whole tree to be counted. The @job->total is refined
+ * while counting goes on and the #FmFileOpsJob::percent signal is emitted
+ * against the total counted so far, it never goes backwards. If the
+ * thread cannot be created then @dc is run synchronously. Each call should
+ * be paired with the call to _fm_file_ops_job_finish_count().
+ */
+void _fm_file_ops_job_start_count(FmFileOpsJob* job, FmDeepCountJob* dc,
+                                  gboolean by_count)
+{
+    FmFileOpsCounter* cnt = g_slice_new(FmFileOpsCounter);
+
+    /* the count has own cancellable so it can be stopped if the job ends
+       before the count, but cancelling the job should stop it as well */
+    cnt->handler = g_cancellable_connect(fm_job_get_cancellable(FM_JOB(job)),
+                                         G_CALLBACK(on_job_cancelled), dc, NULL);
+    cnt->dc = dc;
+    cnt->by_count = by_count;
+    cnt->done = 0;
+    cnt->finished = g_async_queue_new();
+    cnt->dest_free = -1;
+    cnt->dest_bsize = 0;
+    cnt->space_checked = 0;
+    /* the counter is read by main thread when progress is sampled */
+    G_LOCK(percent);
+    job->total = 0;
+    job->counter = cnt;
+    G_UNLOCK(percent);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    cnt->thread = g_thread_try_new("deep count", count_thread, job, NULL);
+#else
+    cnt->thread = g_thread_create(count_thread, job, TRUE, NULL);
+#endif
+    if(!cnt->thread)
+        count_thread(job);
+}
+
+/*
+ * _fm_file_ops_job_finish_count
+ * @job: the job to finish count for
+ *
+ * Stops the count started by _fm_file_ops_job_start_count() if it is not
+ * finished yet, waits for it, and frees resources. Should be called after
+ * all workers of @job are finished.
+ */
+void _fm_file_ops_job_finish_count(FmFileOpsJob* job)
+{
+    FmFileOpsCounter* cnt = (FmFileOpsCounter*)job->counter;
+
+    if(!cnt)
+        return;
+    if(!g_atomic_int_get(&cnt->done))
+        fm_job_cancel(FM_JOB(cnt->dc));
+    if(cnt->thread)
+        g_thread_join(cnt->thread);
+    g_cancellable_disconnect(fm_job_get_cancellable(FM_JOB(job)), cnt->handler);
+    G_LOCK(percent);
+    job->counter = NULL;
+    G_UNLOCK(percent);
+    g_object_unref(cnt->dc);
+    g_async_queue_unref(cnt->finished);
+    g_slice_free(FmFileOpsCounter, cnt);
+}
+
+#ifdef SEEK_HOLE
+/* filesystems which may store data compressed so their files use less
+   blocks than their size even without holes */
+static const char* compressing_fs[] = { "btrfs", "zfs", "squashfs", "erofs", NULL };
+
+/* returns TRUE if size on disk of all sources tells how much data will be
+   written by the native copy */
+static gboolean sources_keep_holes(FmFileOpsJob* job)
+{
+    GList* l;
+    GFile* gf;
+    GFileInfo* inf;
+    const char* fs_type;
+    int i;
+    gboolean ret = TRUE;
+
+    for(l = fm_path_list_peek_head_link(job->srcs); l && ret; l = l->next)
     {
-        gdouble dpercent = (gdouble)(job->finished + job->current_file_finished) / job->total;
-        percent = (guint)(dpercent * 100);
-        if(percent > 100)
-            percent = 100;
+        if(!fm_path_is_native(FM_PATH(l->data)))
+            return FALSE;
+        gf = fm_path_to_gfile(FM_PATH(l->data));
+        inf = g_file_query_filesystem_info(gf, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE,
+                                           fm_job_get_cancellable(FM_JOB(job)), NULL);
+        g_object_unref(gf);
+        if(!inf)
+            return FALSE;
+        fs_type = g_file_info_get_attribute_string(inf, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE);
+        if(!fs_type)
+            ret = FALSE;
+        for(i = 0; ret && compressing_fs[i]; i++)
+            if(strcmp(fs_type, compressing_fs[i]) == 0)
+                ret = FALSE;
+        g_object_unref(inf);
+    }
+    return ret;
+}
+#endif
+
+static void query_dest_space(FmFileOpsJob* job, FmFileOpsCounter* cnt)
+{
+    GFile* gf = fm_path_to_gfile(job->dest);
+    GFileInfo* inf;
+
+    cnt->dest_bsize = 1;
+#ifdef SEEK_HOLE
+    /* only _fm_file_ops_job_copy_native() copies data and not holes */
+    cnt->keeps_holes = g_file_is_native(gf) && sources_keep_holes(job);
+#else
+    cnt->keeps_holes = FALSE;
+#endif
+#ifdef HAVE_SYS_STATVFS_H
+    if(g_file_is_native(gf))
+    {
+        char* path = g_file_get_path(gf);
+        struct statvfs st;
+        if(path && statvfs(path, &st) == 0)
+        {
+            cnt->dest_bsize = st.f_frsize ? st.f_frsize : st.f_bsize;
+            cnt->dest_free = (goffset)st.f_bavail * cnt->dest_bsize;
+        }
+        g_free(path);
+    }
+#endif
+    if(cnt->dest_free < 0)
+    {
+        inf = g_file_query_filesystem_info(gf, G_FILE_ATTRIBUTE_FILESYSTEM_FREE,
+                                           fm_job_get_cancellable(FM_JOB(job)), NULL);
+        if(inf)
+        {
+            if(g_file_info_has_attribute(inf, G_FILE_ATTRIBUTE_FILESYSTEM_FREE))
+                cnt->dest_free = g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+            g_object_unref(inf);
+        }
     }
+    g_object_unref(gf);
+}
+
+/* returns space needed on the destination for the size counted so far */
+static goffset get_needed_space(FmFileOpsCounter* cnt)
+{
+    goffset total_size, total_ondisk_size, needed;
+
+    _fm_deep_count_job_get_totals(cnt->dc, NULL, &total_size, &total_ondisk_size);
+    /* holes of sparse files are kept by native copy so only allocated
+       blocks are needed, otherwise files will take whole blocks on the
+       destination; the size on disk of remote files or of compressed
+       files says nothing about data to write */
+    if(cnt->keeps_holes && total_ondisk_size > 0)
+        needed = total_ondisk_size;
     else
-        percent = 100;
+        needed = MAX(total_ondisk_size, total_size);
+    return (needed + cnt->dest_bsize - 1) / cnt->dest_bsize * cnt->dest_bsize;
+}
 
-    if( percent > job->percent )
+/* waits for the count to be finished, but not longer than the interval */
+static void wait_count(FmFileOpsCounter* cnt)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    if(g_async_queue_timeout_pop(cnt->finished, SPACE_CHECK_INTERVAL * 1000))
+#else
+    GTimeVal end_time;
+
+    g_get_current_time(&end_time);
+    g_time_val_add(&end_time, SPACE_CHECK_INTERVAL * 1000);
+    if(g_async_queue_timed_pop(cnt->finished, &end_time))
+#endif
+        /* the count thread never pushes it again, others should see it */
+        g_async_queue_push(cnt->finished, GINT_TO_POINTER(1));
+}
+
+/*
+ * _fm_file_ops_job_check_space
+ * @job: the job to check
+ *
+ * Compares free space on the destination with the size counted by the
+ * concurrent deep count, see _fm_file_ops_job_start_count(). If there
+ * is not enough space then asks user whether to continue. Should be
+ * called before anything is written to the destination: the first call
+ * waits until the count is finished, or until the size counted so far
+ * exceeds free space so the user is warned without waiting for the whole
+ * tree. For a single file or a flat selection the count is finished as
+ * soon as sizes of the top level items are known. Subsequent calls do
+ * nothing. This function may be called from any thread of @job except
+ * the main one.
+ *
+ * Returns: %FALSE if user decided to cancel the job.
+ */
+gboolean _fm_file_ops_job_check_space(FmFileOpsJob* job)
+{
+    FmFileOpsCounter* cnt = (FmFileOpsCounter*)job->counter;
+    goffset needed;
+    gboolean done;
+
+    if(!cnt || g_atomic_int_get(&cnt->space_checked) || !job->dest)
+        return TRUE;
+    G_LOCK(space);
+    if(cnt->dest_bsize == 0) /* the first call */
+        query_dest_space(job, cnt);
+    /* another worker may ask user already, or space cannot be checked */
+    if(g_atomic_int_get(&cnt->space_checked) || cnt->dest_free < 0)
     {
-        fm_job_call_main_thread(FM_JOB(job), emit_percent, GUINT_TO_POINTER(percent));
-        job->percent = percent;
+        g_atomic_int_set(&cnt->space_checked, 1);
+        G_UNLOCK(space);
+        return TRUE;
+    }
+    /* cancelling the job stops the count as well so it never waits long */
+    for(;;)
+    {
+        done = g_atomic_int_get(&cnt->done);
+        needed = get_needed_space(cnt);
+        if(done || needed > cnt->dest_free)
+            break;
+        wait_count(cnt);
+    }
+    g_atomic_int_set(&cnt->space_checked, 1);
+    G_UNLOCK(space);
+    if(needed > cnt->dest_free && !fm_job_is_cancelled(FM_JOB(job)))
+    {
+        char needed_str[64], free_str[64];
+        char* msg;
+        gint res;
+
+        fm_file_size_to_str(needed_str, sizeof(needed_str), needed, fm_config->si_unit);
+        fm_file_size_to_str(free_str, sizeof(free_str), cnt->dest_free, fm_config->si_unit);
+        msg = g_strdup_printf(done ? _("There is not enough free space in the destination: %s is required but only %s is available.\n\nDo you want to continue anyway?")
+                                   : _("There is not enough free space in the destination: at least %s is required but only %s is available.\n\nDo you want to continue anyway?"),
+                              needed_str, free_str);
+        res = fm_job_ask(FM_JOB(job), msg, _("_Continue"), _("_Cancel"), NULL);
+        g_free(msg);
+        if(res != 0)
+        {
+            fm_job_cancel(FM_JOB(job));
+            return FALSE;
+        }
     }
+    return TRUE;
 }
 
 static gpointer emit_prepared(FmJob* job, gpointer user_data)
@@ -448,6 +1112,12 @@ static gpointer emit_prepared(FmJob* job, gpointer user_data)
  */
 void fm_file_ops_job_emit_prepared(FmFileOpsJob* job)
 {
+    FmFileOpsRate* rate = (FmFileOpsRate*)job->rate;
+
+    G_LOCK(percent);
+    g_timer_start(rate->timer);
+    rate->last_time = 0.0;
+    G_UNLOCK(percent);
     fm_job_call_main_thread(FM_JOB(job), emit_prepared, NULL);
 }
 
@@ -570,7 +1240,7 @@ static gboolean _fm_file_ops_job_link_run(FmFileOpsJob* job)
         return FALSE;
     }
 
-    job->total = fm_path_list_get_length(job->srcs);
+    _fm_file_ops_job_set_total(job, fm_path_list_get_length(job->srcs));
     g_debug("total files to link: %lu", (gulong)job->total);
 
     fm_file_ops_job_emit_prepared(job);
@@ -647,7 +1317,7 @@ _link_error:
             g_free(dname);
         }
 
-        job->finished++;
+        _fm_file_ops_job_add_progress(job, 1, 0, 1);
 
         /* update progress */
         fm_file_ops_job_emit_percent(job);
@@ -130,6 +130,14 @@ struct _FmFileOpsJob
     /* dummy file monitors, used to simulate file event for remote file systems */
     GFileMonitor* src_folder_mon;
     GFileMonitor* dest_folder_mon;
+
+    /*< private >*/
+    gpointer copy_pool; /* workers for concurrent copy of regular files */
+    gpointer counter; /* deep count running concurrently with the job */
+    gpointer rate; /* estimation of transfer rate */
+    gpointer journal; /* record of copied files to resume interrupted job */
+    gboolean resumable;
+    goffset direct_io_threshold; /* 0 if page cache is always used */
 };
 
 /**
@@ -139,6 +147,7 @@ struct _FmFileOpsJob
  * @cur_file: the class closure for the #FmFileOpsJob::cur-file signal
  * @percent: the class closure for the #FmFileOpsJob::percent signal
  * @ask_rename: the class closure for the #FmFileOpsJob::ask-rename signal
+ * @rate: the class closure for the #FmFileOpsJob::rate signal
  */
 struct _FmFileOpsJobClass
 {
@@ -147,6 +156,7 @@ struct _FmFileOpsJobClass
     void (*cur_file)(FmFileOpsJob* job, const char* file);
     void (*percent)(FmFileOpsJob* job, guint percent);
     FmFileOpOption (*ask_rename)(FmFileOpsJob* job, FmFileInfo* src, FmFileInfo* dest, char** new_name);
+    void (*rate)(FmFileOpsJob* job);
 };
 
 GType fm_file_ops_job_get_type        (void);
@@ -157,6 +167,10 @@ FmPath* fm_file_ops_job_get_dest(FmFileOpsJob* job);
 /* This only work for change attr jobs. */
 void fm_file_ops_job_set_recursive(FmFileOpsJob* job, gboolean recursive);
 
+/* This only work for copy and move jobs. */
+void fm_file_ops_job_set_resumable(FmFileOpsJob* job, gboolean resumable);
+void fm_file_ops_job_set_direct_io(FmFileOpsJob* job, goffset threshold);
+
 void fm_file_ops_job_set_chmod(FmFileOpsJob* job, mode_t new_mode, mode_t new_mode_mask);
 void fm_file_ops_job_set_chown(FmFileOpsJob* job, gint uid, gint gid);
 
@@ -166,6 +180,8 @@ void fm_file_ops_job_set_icon(FmFileOpsJob *job, GIcon *icon);
 void fm_file_ops_job_set_hidden(FmFileOpsJob *job, gboolean hidden);
 void fm_file_ops_job_set_target(FmFileOpsJob *job, const char *url);
 
+void fm_file_ops_job_get_rate(FmFileOpsJob* job, goffset* rate, goffset* avg_rate, gint* remaining);
+
 void fm_file_ops_job_emit_prepared(FmFileOpsJob* job);
 void fm_file_ops_job_emit_cur_file(FmFileOpsJob* job, const char* cur_file);
 void fm_file_ops_job_emit_percent(FmFileOpsJob* job);